@@ -0,0 +1,167 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+#include <stdlib.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+
+/* All arena and pool allocations are aligned for any lop_arg member */
+#define LOP_ALIGN 8
+#define lop_align(x) (((x) + LOP_ALIGN - 1) & ~(size_t)(LOP_ALIGN - 1))
+
+/* Smallest and largest pool size classes, as powers of two */
+#define LOP_POOL_MIN_SHIFT 6
+#define LOP_POOL_MAX_SHIFT (LOP_POOL_MIN_SHIFT + LOP_POOL_CLASSES - 1)
+
+typedef struct _lop_arena_chunk {
+    struct _lop_arena_chunk *prev;
+    size_t size;
+} lop_arena_chunk;
+
+typedef union {
+    /* size class while allocated, free list link while pooled */
+    int class;
+    void *next;
+    double align;
+} lop_pool_block;
+
+#define LOP_CHUNK_HDR lop_align(sizeof(lop_arena_chunk))
+#define LOP_BLOCK_HDR lop_align(sizeof(lop_pool_block))
+
+int lop_arena_init(lop_arena *a, size_t size)
+{
+    a->chunk = malloc(LOP_CHUNK_HDR + size);
+    if (!a->chunk) {
+        return -1;
+    }
+    a->chunk->prev = NULL;
+    a->chunk->size = size;
+    a->used = 0;
+    return 0;
+}
+
+void *lop_arena_alloc(lop_arena *a, size_t size)
+{
+    lop_arena_chunk *c = a->chunk;
+
+    size = lop_align(size);
+    if (a->used + size > c->size) {
+        /* Chain a larger chunk. The old ones are released by the next
+         * reset, after which the arena is big enough for this load. */
+        size_t csize = c->size * 2;
+
+        while (csize < size) {
+            csize *= 2;
+        }
+        c = malloc(LOP_CHUNK_HDR + csize);
+        if (!c) {
+            return NULL;
+        }
+        c->prev = a->chunk;
+        c->size = csize;
+        a->chunk = c;
+        a->used = 0;
+    }
+    a->used += size;
+    return (char *)c + LOP_CHUNK_HDR + a->used - size;
+}
+
+void lop_arena_reset(lop_arena *a)
+{
+    lop_arena_chunk *c, *prev;
+
+    for (c = a->chunk->prev; c; c = prev) {
+        prev = c->prev;
+        free(c);
+    }
+    a->chunk->prev = NULL;
+    a->used = 0;
+}
+
+void lop_arena_free(lop_arena *a)
+{
+    if (a->chunk) {
+        lop_arena_reset(a);
+        free(a->chunk);
+        a->chunk = NULL;
+    }
+}
+
+void *lop_pool_alloc(lop_pool *p, size_t size)
+{
+    lop_pool_block *b;
+    int class = 0;
+
+    if (!p->enabled) {
+        return malloc(size);
+    }
+
+    size += LOP_BLOCK_HDR;
+    while (class < LOP_POOL_CLASSES &&
+           size > ((size_t)1 << (LOP_POOL_MIN_SHIFT + class))) {
+        class++;
+    }
+    if (class < LOP_POOL_CLASSES && p->free[class]) {
+        b = p->free[class];
+        p->free[class] = b->next;
+    } else {
+        b = malloc(class < LOP_POOL_CLASSES ?
+                   (size_t)1 << (LOP_POOL_MIN_SHIFT + class) : size);
+        if (!b) {
+            return NULL;
+        }
+    }
+    b->class = class;
+    return (char *)b + LOP_BLOCK_HDR;
+}
+
+void lop_pool_release(lop_pool *p, void *ptr)
+{
+    lop_pool_block *b;
+    int class;
+
+    if (!p->enabled) {
+        free(ptr);
+        return;
+    }
+    if (!ptr) {
+        return;
+    }
+
+    b = (lop_pool_block *)((char *)ptr - LOP_BLOCK_HDR);
+    class = b->class;
+    if (class < LOP_POOL_CLASSES) {
+        b->next = p->free[class];
+        p->free[class] = b;
+    } else {
+        free(b);
+    }
+}
+
+void lop_pool_free(lop_pool *p)
+{
+    lop_pool_block *b, *next;
+    int class;
+
+    for (class = 0; class < LOP_POOL_CLASSES; class++) {
+        for (b = p->free[class]; b; b = next) {
+            next = b->next;
+            free(b);
+        }
+        p->free[class] = NULL;
+    }
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
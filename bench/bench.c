@@ -0,0 +1,177 @@
+/*
+ *  Benchmark harness for the host build of liblop.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "bench.h"
+
+double bench_min_time = 0.2;
+
+static const bench_suite suites[] = {
+    { "parse", bench_parse },
+    { "dispatch", bench_dispatch },
+    { "wildcard", bench_wildcard },
+    { "sched", bench_sched },
+    { "wait", bench_wait },
+    { "stream", bench_stream },
+    { "string", bench_string },
+    { NULL, NULL }
+};
+
+/* Allocation counting. The bench is linked with --wrap for each of these
+ * symbols, so every call made from liblop.a lands here first. */
+
+static uint64_t alloc_count;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t nmemb, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+char *__real_strdup(const char *s);
+
+void *__wrap_malloc(size_t size)
+{
+    alloc_count++;
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t nmemb, size_t size)
+{
+    alloc_count++;
+    return __real_calloc(nmemb, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    alloc_count++;
+    return __real_realloc(ptr, size);
+}
+
+void __wrap_free(void *ptr)
+{
+    __real_free(ptr);
+}
+
+char *__wrap_strdup(const char *s)
+{
+    alloc_count++;
+    return __real_strdup(s);
+}
+
+void bench_alloc_reset(void)
+{
+    alloc_count = 0;
+}
+
+uint64_t bench_alloc_count(void)
+{
+    return alloc_count;
+}
+
+uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void bench_header(const char *title)
+{
+    printf("\n== %s\n", title);
+    printf("%-40s %8s %14s %10s %12s\n", "case", "size", "msgs/s",
+           "ns/msg", "allocs/msg");
+}
+
+void bench_report(const char *name, size_t size, uint64_t elapsed,
+    double msgs, uint64_t allocs)
+{
+    double ns = (double)elapsed / msgs;
+
+    printf("%-40s %8lu %14.0f %10.1f %12.2f\n", name, (unsigned long)size,
+           1e9 / ns, ns, (double)allocs / msgs);
+    fflush(stdout);
+}
+
+void bench_run(const char *name, size_t size, void (*fn)(void *), void *arg,
+    unsigned per_call)
+{
+    uint64_t start, elapsed, calls = 0, batch = 1, allocs;
+    uint64_t limit = (uint64_t)(bench_min_time * 1e9);
+    uint64_t i;
+
+    /* warm up caches and any lazily built state */
+    fn(arg);
+
+    bench_alloc_reset();
+    start = bench_now_ns();
+    do {
+        for (i = 0; i < batch; i++) {
+            fn(arg);
+        }
+        calls += batch;
+        if (batch < 65536) {
+            batch *= 2;
+        }
+        elapsed = bench_now_ns() - start;
+    } while (elapsed < limit);
+    allocs = bench_alloc_count();
+
+    bench_report(name, size, elapsed, (double)calls * per_call, allocs);
+}
+
+static void usage(const char *argv0)
+{
+    const bench_suite *it;
+
+    fprintf(stderr, "usage: %s [-t seconds] [suite...]\n\nsuites:", argv0);
+    for (it = suites; it->name; it++) {
+        fprintf(stderr, " %s", it->name);
+    }
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char *argv[])
+{
+    const bench_suite *it;
+    int i, selected = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+            bench_min_time = atof(argv[++i]);
+            argv[i - 1] = argv[i] = NULL;
+        } else if (argv[i][0] == '-') {
+            usage(argv[0]);
+            return 1;
+        } else {
+            selected++;
+        }
+    }
+
+    for (it = suites; it->name; it++) {
+        int run = !selected;
+
+        for (i = 1; i < argc && !run; i++) {
+            run = argv[i] && !strcmp(argv[i], it->name);
+        }
+        if (run) {
+            it->run();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,62 @@
+/*
+ *  Benchmark harness for the host build of liblop.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#ifndef LOP_BENCH_H
+#define LOP_BENCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "lop/lop_lowlevel.h"
+
+/* A named group of benchmark cases, selectable from the command line */
+typedef struct {
+    const char *name;
+    void (*run)(void);
+} bench_suite;
+
+/* Minimum wall time, in seconds, each case is run for */
+extern double bench_min_time;
+
+uint64_t bench_now_ns(void);
+
+/* Number of malloc/calloc/realloc/strdup calls made since the last reset */
+void bench_alloc_reset(void);
+uint64_t bench_alloc_count(void);
+
+/* Print a section header followed by the column titles */
+void bench_header(const char *title);
+
+/*
+ * Call fn(arg) repeatedly for at least bench_min_time seconds and report
+ * the throughput. Each call is expected to process per_call messages;
+ * size is printed alongside the case name (eg. the method table size).
+ */
+void bench_run(const char *name, size_t size, void (*fn)(void *), void *arg,
+    unsigned per_call);
+
+/* Print one result line: msgs messages processed in elapsed ns */
+void bench_report(const char *name, size_t size, uint64_t elapsed,
+    double msgs, uint64_t allocs);
+
+void bench_parse(void);
+void bench_dispatch(void);
+void bench_wildcard(void);
+void bench_sched(void);
+void bench_wait(void);
+void bench_stream(void);
+void bench_string(void);
+
+#endif
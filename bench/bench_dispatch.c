@@ -0,0 +1,735 @@
+/*
+ *  Parse and dispatch benchmarks.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "lop/lop_endian.h"
+
+#define BUNDLE_ELEMENTS 8
+
+/* Packets per receive call, as recvmmsg() might return them */
+#define BATCH 64
+
+static const char *params[] = {
+    "fader", "mute", "pan", "gain", "eq", "send", "solo", "meter"
+};
+#define NPARAMS (sizeof(params) / sizeof(params[0]))
+
+static volatile int sink;
+
+typedef struct {
+    lop_server s;
+    char *packet;
+    size_t size;
+    char *buf;
+} dispatch_case;
+
+static int handler(const char *path, const char *types, lop_arg **argv,
+    int argc, lop_message msg, void *user_data)
+{
+    sink += argc;
+    return 0;
+}
+
+/* Build a mixer-style namespace of n methods: /mixer/ch<i>/<param> */
+static lop_server make_server(int n, int arena)
+{
+    lop_server s = lop_server_new(NULL, NULL, NULL);
+    char path[64];
+    int i;
+
+    for (i = 0; i < n; i++) {
+        const char *param = params[i % NPARAMS];
+
+        snprintf(path, sizeof(path), "/mixer/ch%d/%s", i / (int)NPARAMS,
+                 param);
+        lop_server_add_method(s, path, strcmp(param, "mute") ? "f" : "i",
+                              handler, NULL);
+    }
+    if (arena) {
+        lop_server_enable_arena(s, 0);
+    }
+    return s;
+}
+
+static char *make_message(const char *path, char type, size_t *size)
+{
+    lop_message m = lop_message_new();
+    char *packet;
+
+    if (type == LOP_INT32) {
+        lop_message_add_int32(m, 42);
+    } else {
+        lop_message_add_float(m, 0.5f);
+    }
+    packet = lop_message_serialise(m, path, NULL, size);
+    lop_message_free(m);
+    return packet;
+}
+
+/* An immediate bundle holding count copies of the given message */
+static char *make_bundle(const char *msg, size_t msg_size, int count,
+    size_t *size)
+{
+    char *packet, *pos;
+    int i;
+
+    *size = 16 + count * (4 + msg_size);
+    packet = malloc(*size);
+    memcpy(packet, "#bundle\0", 8);
+    *(uint32_t *)(packet + 8) = lop_htoo32(0);
+    *(uint32_t *)(packet + 12) = lop_htoo32(1);
+    pos = packet + 16;
+    for (i = 0; i < count; i++) {
+        *(uint32_t *)pos = lop_htoo32(msg_size);
+        memcpy(pos + 4, msg, msg_size);
+        pos += 4 + msg_size;
+    }
+    return packet;
+}
+
+static void run_dispatch(void *arg)
+{
+    dispatch_case *c = arg;
+
+    /* packets arrive in a fresh receive buffer every time */
+    memcpy(c->buf, c->packet, c->size);
+    lop_server_dispatch_data(c->s, c->buf, c->size);
+}
+
+static void bench_case(const char *name, int n, lop_server s, char *packet,
+    size_t size, unsigned per_call)
+{
+    dispatch_case c;
+
+    c.s = s;
+    c.packet = packet;
+    c.size = size;
+    c.buf = malloc(size);
+    bench_run(name, n, run_dispatch, &c, per_call);
+    free(c.buf);
+    free(packet);
+}
+
+typedef struct {
+    lop_server s;
+    char *packets;
+    size_t size;
+    char *buf;
+    struct iovec iov[BATCH];
+} batch_case;
+
+static void run_packet_loop(void *arg)
+{
+    batch_case *c = arg;
+    int i;
+
+    memcpy(c->buf, c->packets, BATCH * c->size);
+    for (i = 0; i < BATCH; i++) {
+        lop_server_dispatch_data(c->s, c->iov[i].iov_base, c->iov[i].iov_len);
+    }
+}
+
+static void run_batch(void *arg)
+{
+    batch_case *c = arg;
+    int status[BATCH];
+
+    memcpy(c->buf, c->packets, BATCH * c->size);
+    lop_server_dispatch_batch(c->s, c->iov, BATCH, status);
+}
+
+/* BATCH messages to different channels, dispatched one by one and as a
+ * batch */
+static void bench_batch(int n, int arena)
+{
+    const char *prefix = arena ? "arena " : "";
+    lop_server s = make_server(n, arena);
+    int nch = (n + NPARAMS - 1) / NPARAMS;
+    batch_case c;
+    char name[64];
+    int i;
+
+    c.s = s;
+    for (i = 0; i < BATCH; i++) {
+        char path[64], *msg, *packet;
+        size_t msg_size;
+
+        /* ,i so every packet is coerced and needs scratch space, in a
+         * bundle so the clock is consulted */
+        snprintf(path, sizeof(path), "/mixer/ch%d/fader", i % nch);
+        msg = make_message(path, LOP_INT32, &msg_size);
+        packet = make_bundle(msg, msg_size, 1, &c.size);
+        if (!i) {
+            c.packets = malloc(BATCH * c.size);
+            c.buf = malloc(BATCH * c.size);
+        }
+        memcpy(c.packets + i * c.size, packet, c.size);
+        c.iov[i].iov_base = c.buf + i * c.size;
+        c.iov[i].iov_len = c.size;
+        free(packet);
+        free(msg);
+    }
+
+    snprintf(name, sizeof(name), "%sx%d per-packet loop bundled ,i->f",
+             prefix, BATCH);
+    bench_run(name, n, run_packet_loop, &c, BATCH);
+    snprintf(name, sizeof(name), "%sx%d dispatch_batch bundled ,i->f",
+             prefix, BATCH);
+    bench_run(name, n, run_batch, &c, BATCH);
+
+    free(c.packets);
+    free(c.buf);
+    lop_server_free(s);
+}
+
+/* A bank of n meters delivered to a handler taking floats, as floats
+ * and as ints and doubles to be coerced */
+static void bench_coerce(int n)
+{
+    static const lop_type types[] = { LOP_FLOAT, LOP_INT32, LOP_DOUBLE };
+    lop_server s = lop_server_new(NULL, NULL, NULL);
+    char *spec = malloc(n + 1), name[64];
+    unsigned i;
+    int k;
+
+    memset(spec, LOP_FLOAT, n);
+    spec[n] = '\0';
+    lop_server_add_method(s, "/meters", spec, handler, NULL);
+    for (i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        lop_message m = lop_message_new();
+        char *packet;
+        size_t size;
+
+        for (k = 0; k < n; k++) {
+            switch (types[i]) {
+            case LOP_INT32: lop_message_add_int32(m, k); break;
+            case LOP_DOUBLE: lop_message_add_double(m, k * 0.25); break;
+            default: lop_message_add_float(m, k * 0.5f); break;
+            }
+        }
+        packet = lop_message_serialise(m, "/meters", NULL, &size);
+        if (types[i] == LOP_FLOAT) {
+            snprintf(name, sizeof(name), "meters x%d exact ,f", n);
+        } else {
+            snprintf(name, sizeof(name), "meters x%d coerced ,%c->f", n,
+                     types[i]);
+        }
+        bench_case(name, 1, s, packet, size, 1);
+        lop_message_free(m);
+    }
+    free(spec);
+    lop_server_free(s);
+}
+
+static void run_view(void *arg)
+{
+    dispatch_case *c = arg;
+    static lop_arg *argv[1024];
+    lop_message_view v;
+
+    memcpy(c->buf, c->packet, c->size);
+    lop_message_view_init(&v, c->buf, c->size, argv, 1024);
+}
+
+static void run_deserialise(void *arg)
+{
+    dispatch_case *c = arg;
+    lop_message m;
+
+    memcpy(c->buf, c->packet, c->size);
+    m = lop_message_deserialise(c->buf, c->size, NULL);
+    lop_message_free(m);
+}
+
+typedef struct {
+    lop_message m;
+    const char *path;
+    char *buf;
+    size_t size;
+} serialise_case;
+
+static void run_serialise(void *arg)
+{
+    serialise_case *c = arg;
+
+    lop_message_serialise(c->m, c->path, c->buf, NULL);
+}
+
+/* What replies did: measure, then serialise into a fresh allocation */
+static void run_serialise_alloc(void *arg)
+{
+    serialise_case *c = arg;
+    size_t size = lop_message_length(c->m, c->path);
+    void *data = lop_message_serialise(c->m, c->path, NULL, NULL);
+
+    sink += size;
+    free(data);
+}
+
+static void run_serialise_into(void *arg)
+{
+    serialise_case *c = arg;
+
+    sink += lop_message_serialise_into(c->m, c->path, c->buf, c->size);
+}
+
+static void run_serialise_iov(void *arg)
+{
+    serialise_case *c = arg;
+    struct iovec iov[8];
+
+    sink += lop_message_serialise_iov(c->m, c->path, iov, 8, c->buf,
+                                      c->size);
+}
+
+/* The numeric part of lop_coerce() as it was, through lop_hires */
+static int ref_coerce(lop_type type_to, lop_arg *to, lop_type type_from,
+    lop_arg *from)
+{
+    if (!lop_is_numerical_type(type_to) || !lop_is_numerical_type(type_from)) {
+        return 0;
+    }
+    switch (type_to) {
+    case LOP_INT32:
+        to->i = (uint32_t)lop_hires_val(type_from, from);
+        break;
+    case LOP_INT64:
+        to->i64 = (uint64_t)lop_hires_val(type_from, from);
+        break;
+    case LOP_FLOAT:
+        to->f = (float)lop_hires_val(type_from, from);
+        break;
+    case LOP_DOUBLE:
+        to->d = (double)lop_hires_val(type_from, from);
+        break;
+    default:
+        return 0;
+    }
+    return 1;
+}
+
+typedef struct {
+    const char *types;
+    lop_arg **argv;
+    lop_type to;
+    int (*coerce)(lop_type type_to, lop_arg *to, lop_type type_from,
+                  lop_arg *from);
+} coerce_case;
+
+/* Coerce every argument to one type, as a handler taking ,d... would */
+static void run_coerce(void *arg)
+{
+    coerce_case *c = arg;
+    lop_arg to;
+    int i;
+
+    for (i = 0; c->types[i]; i++) {
+        sink += c->coerce(c->to, &to, c->types[i], c->argv[i]);
+    }
+}
+
+typedef struct {
+    lop_message m;
+    char paths[BUNDLE_ELEMENTS][32];
+    char *buf;
+    lop_bundle b;
+} bundle_case;
+
+/* What callers did: serialise each message, then copy it into place */
+static void run_bundle_by_hand(void *arg)
+{
+    bundle_case *c = arg;
+    char *pos = c->buf + 16;
+    unsigned i;
+
+    memcpy(c->buf, "#bundle\0", 8);
+    *(uint32_t *)(c->buf + 8) = lop_htoo32(0);
+    *(uint32_t *)(c->buf + 12) = lop_htoo32(1);
+    for (i = 0; i < BUNDLE_ELEMENTS; i++) {
+        size_t size;
+        void *msg = lop_message_serialise(c->m, c->paths[i], NULL, &size);
+
+        *(uint32_t *)pos = lop_htoo32(size);
+        memcpy(pos + 4, msg, size);
+        pos += 4 + size;
+        free(msg);
+    }
+    sink += pos - c->buf;
+}
+
+static void run_bundle_builder(void *arg)
+{
+    bundle_case *c = arg;
+    size_t size;
+    unsigned i;
+
+    lop_bundle_reset(c->b, LOP_TT_IMMEDIATE);
+    for (i = 0; i < BUNDLE_ELEMENTS; i++) {
+        lop_bundle_add_message(c->b, c->paths[i], c->m);
+    }
+    lop_bundle_data(c->b, &size);
+    sink += size;
+}
+
+typedef struct {
+    lop_message m;
+    float *out;
+} extract_case;
+
+/* What a handler filling a float buffer did: chase argv, convert each */
+static void run_argv_floats(void *arg)
+{
+    extract_case *c = arg;
+    lop_arg **argv = lop_message_get_argv(c->m);
+    const char *types = lop_message_get_types(c->m);
+    int i, argc = lop_message_get_argc(c->m);
+
+    for (i = 0; i < argc; i++) {
+        c->out[i] = types[i] == LOP_FLOAT ? argv[i]->f : argv[i]->i;
+    }
+}
+
+static void run_get_floats(void *arg)
+{
+    extract_case *c = arg;
+
+    sink += lop_message_get_floats(c->m, 0, -1, c->out);
+}
+
+typedef struct {
+    const char *str;
+    const char *pattern;
+} pattern_case;
+
+static void run_pattern(void *arg)
+{
+    pattern_case *c = arg;
+
+    sink += lop_pattern_match(c->str, c->pattern);
+}
+
+typedef struct {
+    const char *str;
+    lop_pattern p;
+} compiled_case;
+
+static void run_compiled(void *arg)
+{
+    compiled_case *c = arg;
+
+    sink += lop_pattern_exec(c->p, c->str);
+}
+
+void bench_parse(void)
+{
+    static const pattern_case patterns[] = {
+        { "/mixer/ch12/fader", "/mixer/ch12/fader" },
+        { "/mixer/ch12/fader", "/mixer/*/fader" },
+        { "/mixer/ch12/fader", "/mixer/ch1?/{pan,fader}" },
+        { "/mixer/ch12/fader", "/mixer/ch[0-9]*/f*r" },
+        /* backtracks over every placement of the '*'s, then fails */
+        { "/mixer/aaaaaaaaaaaaaaaaaaaaaaaa", "/mixer/*a*a*a*a*a*b" },
+    };
+    dispatch_case c;
+    serialise_case sc;
+    lop_message m;
+    unsigned i;
+
+    bench_header("parse");
+
+    m = lop_message_new();
+    lop_message_add_float(m, 0.5f);
+    lop_message_add_int32(m, 7);
+    lop_message_add_string(m, "channel label");
+    lop_message_add_double(m, 0.25);
+    c.packet = lop_message_serialise(m, "/mixer/ch12/fader", NULL, &c.size);
+    c.buf = malloc(c.size);
+    bench_run("deserialise ,fisd", 0, run_deserialise, &c, 1);
+    bench_run("view ,fisd", 0, run_view, &c, 1);
+
+    sc.m = m;
+    sc.path = "/mixer/ch12/fader";
+    sc.buf = c.buf;
+    sc.size = c.size;
+    bench_run("serialise ,fisd", 0, run_serialise, &sc, 1);
+    bench_run("serialise ,fisd to new buffer", 0, run_serialise_alloc, &sc,
+              1);
+    bench_run("serialise_into ,fisd", 0, run_serialise_into, &sc, 1);
+    free(c.packet);
+    free(c.buf);
+    lop_message_free(m);
+
+    m = lop_message_new();
+    for (i = 0; i < 8; i++) {
+        lop_message_add_int32(m, i);
+        lop_message_add_float(m, i * 0.5f);
+        lop_message_add_double(m, i * 0.25);
+        lop_message_add_int64(m, i);
+    }
+    c.packet = lop_message_serialise(m, "/meters", NULL, &c.size);
+    c.buf = malloc(c.size);
+    bench_run("deserialise ,(ifdh)x8", 0, run_deserialise, &c, 1);
+
+    {
+        coerce_case cc;
+
+        cc.types = lop_message_get_types(m);
+        cc.argv = lop_message_get_argv(m);
+        cc.to = LOP_DOUBLE;
+        cc.coerce = ref_coerce;
+        bench_run("long double coerce ,(ifdh)x8 -> d", 0, run_coerce, &cc,
+                  32);
+        cc.coerce = lop_coerce;
+        bench_run("lop_coerce ,(ifdh)x8 -> d", 0, run_coerce, &cc, 32);
+    }
+
+    sc.m = m;
+    sc.path = "/meters";
+    sc.buf = c.buf;
+    bench_run("serialise ,(ifdh)x8", 0, run_serialise, &sc, 1);
+    free(c.packet);
+    free(c.buf);
+    lop_message_free(m);
+
+    /* sensor and meter banks */
+    for (i = 64; i <= 512; i *= 8) {
+        char name[64];
+        unsigned n;
+
+        m = lop_message_new();
+        for (n = 0; n < i; n++) {
+            lop_message_add_float(m, n * 0.5f);
+        }
+        c.packet = lop_message_serialise(m, "/meters", NULL, &c.size);
+        c.buf = malloc(c.size);
+        snprintf(name, sizeof(name), "deserialise %u floats", i);
+        bench_run(name, i, run_deserialise, &c, 1);
+        snprintf(name, sizeof(name), "view %u floats", i);
+        bench_run(name, i, run_view, &c, 1);
+        sc.m = m;
+        sc.path = "/meters";
+        sc.buf = c.buf;
+        sc.size = c.size;
+        snprintf(name, sizeof(name), "serialise %u floats", i);
+        bench_run(name, i, run_serialise, &sc, 1);
+        snprintf(name, sizeof(name), "serialise %u floats to new buffer", i);
+        bench_run(name, i, run_serialise_alloc, &sc, 1);
+        snprintf(name, sizeof(name), "serialise_into %u floats", i);
+        bench_run(name, i, run_serialise_into, &sc, 1);
+        free(c.packet);
+        free(c.buf);
+        lop_message_free(m);
+    }
+
+    /* a bundle of control messages, one per parameter */
+    {
+        bundle_case bc;
+        unsigned n;
+
+        for (n = 0; n < BUNDLE_ELEMENTS; n++) {
+            snprintf(bc.paths[n], sizeof(bc.paths[n]), "/mixer/ch12/%s",
+                     params[n]);
+        }
+        bc.m = lop_message_new();
+        lop_message_add_float(bc.m, 0.5f);
+        lop_message_add_int32(bc.m, 7);
+        lop_message_add_string(bc.m, "channel label");
+        bc.buf = malloc(16 + BUNDLE_ELEMENTS *
+                        (4 + lop_message_length(bc.m, bc.paths[0])));
+        bc.b = lop_bundle_new(LOP_TT_IMMEDIATE, 0);
+        bench_run("bundle x8 ,fis by hand", 0, run_bundle_by_hand, &bc, 1);
+        bench_run("bundle x8 ,fis lop_bundle", 0, run_bundle_builder, &bc,
+                  1);
+        lop_bundle_free(bc.b);
+        free(bc.buf);
+        lop_message_free(bc.m);
+    }
+
+    /* a sample or file chunk, as sent from a server */
+    for (i = 4096; i <= 65536; i *= 16) {
+        char *bytes = calloc(1, i), name[64];
+        lop_blob b = lop_blob_new(i, bytes);
+
+        m = lop_message_new();
+        lop_message_add_int32(m, 1);
+        lop_message_add_blob(m, b);
+        sc.m = m;
+        sc.path = "/sampler/load";
+        sc.size = lop_message_length(m, sc.path);
+        sc.buf = malloc(sc.size);
+        snprintf(name, sizeof(name), "serialise %u byte blob to new buffer",
+                 i);
+        bench_run(name, i, run_serialise_alloc, &sc, 1);
+        snprintf(name, sizeof(name), "serialise_into %u byte blob", i);
+        bench_run(name, i, run_serialise_into, &sc, 1);
+        snprintf(name, sizeof(name), "serialise_iov %u byte blob", i);
+        bench_run(name, i, run_serialise_iov, &sc, 1);
+        free(sc.buf);
+        lop_message_free(m);
+        lop_blob_free(b);
+        free(bytes);
+    }
+
+    /* meter banks into a float buffer, as floats and as ints */
+    for (i = 64; i <= 512; i *= 8) {
+        static float out[512];
+        extract_case ec;
+        char name[64];
+        unsigned n;
+        int ints;
+
+        for (ints = 0; ints <= 1; ints++) {
+            char type = ints ? LOP_INT32 : LOP_FLOAT;
+
+            ec.m = lop_message_new();
+            ec.out = out;
+            for (n = 0; n < i; n++) {
+                if (ints) {
+                    lop_message_add_int32(ec.m, n);
+                } else {
+                    lop_message_add_float(ec.m, n * 0.5f);
+                }
+            }
+            snprintf(name, sizeof(name), "argv to float[%u] ,%c", i, type);
+            bench_run(name, i, run_argv_floats, &ec, 1);
+            snprintf(name, sizeof(name), "get_floats float[%u] ,%c", i,
+                     type);
+            bench_run(name, i, run_get_floats, &ec, 1);
+            lop_message_free(ec.m);
+        }
+    }
+
+    /* int and double traffic for a handler taking floats */
+    for (i = 0; i < 2; i++) {
+        lop_type from = i ? LOP_DOUBLE : LOP_INT32;
+        coerce_case cc;
+        char name[64];
+        unsigned n;
+
+        m = lop_message_new();
+        for (n = 0; n < 64; n++) {
+            if (from == LOP_INT32) {
+                lop_message_add_int32(m, n);
+            } else {
+                lop_message_add_double(m, n * 0.25);
+            }
+        }
+        cc.types = lop_message_get_types(m);
+        cc.argv = lop_message_get_argv(m);
+        cc.to = LOP_FLOAT;
+        cc.coerce = ref_coerce;
+        snprintf(name, sizeof(name), "long double coerce %c -> f", from);
+        bench_run(name, 0, run_coerce, &cc, 64);
+        cc.coerce = lop_coerce;
+        snprintf(name, sizeof(name), "lop_coerce %c -> f", from);
+        bench_run(name, 0, run_coerce, &cc, 64);
+        lop_message_free(m);
+    }
+
+    /* typical control messages, 4 to 32 mixed arguments */
+    for (i = 4; i <= 32; i *= 2) {
+        char name[64];
+        unsigned n;
+
+        m = lop_message_new();
+        for (n = 0; n < i; n++) {
+            switch (n % 6) {
+            case 0: lop_message_add_int32(m, n); break;
+            case 1: lop_message_add_float(m, n * 0.5f); break;
+            case 2: lop_message_add_string(m, "label"); break;
+            case 3: lop_message_add_double(m, n * 0.25); break;
+            case 4: lop_message_add_int64(m, n); break;
+            case 5: lop_message_add_true(m); break;
+            }
+        }
+        c.packet = lop_message_serialise(m, "/mixer/ch12/eq", NULL, &c.size);
+        c.buf = malloc(c.size);
+        snprintf(name, sizeof(name), "deserialise %u mixed args", i);
+        bench_run(name, i, run_deserialise, &c, 1);
+        snprintf(name, sizeof(name), "view %u mixed args", i);
+        bench_run(name, i, run_view, &c, 1);
+        free(c.packet);
+        free(c.buf);
+        lop_message_free(m);
+    }
+
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        char name[64];
+
+        compiled_case cc;
+
+        snprintf(name, sizeof(name), "pattern_match %s", patterns[i].pattern);
+        bench_run(name, 0, run_pattern, (void *)&patterns[i], 1);
+
+        cc.str = patterns[i].str;
+        cc.p = lop_pattern_compile(patterns[i].pattern);
+        snprintf(name, sizeof(name), "pattern_exec %s", patterns[i].pattern);
+        bench_run(name, 0, run_compiled, &cc, 1);
+        lop_pattern_free(cc.p);
+    }
+}
+
+void bench_dispatch(void)
+{
+    static const int sizes[] = { 10, 100, 1000, 10000 };
+    unsigned i;
+
+    bench_header("dispatch");
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        int n = sizes[i];
+        int nch = (n + NPARAMS - 1) / NPARAMS;
+        lop_server s = make_server(n, 0);
+        char path[64], *msg, *packet;
+        size_t size, msg_size;
+
+        snprintf(path, sizeof(path), "/mixer/ch%d/fader", nch / 2);
+        packet = make_message(path, LOP_FLOAT, &size);
+        bench_case("single exact ,f", n, s, packet, size, 1);
+        packet = make_message(path, LOP_INT32, &size);
+        bench_case("single exact coerced ,i->f", n, s, packet, size, 1);
+
+        msg = make_message(path, LOP_FLOAT, &msg_size);
+        packet = make_bundle(msg, msg_size, BUNDLE_ELEMENTS, &size);
+        bench_case("bundle x8 exact ,f", n, s, packet, size, BUNDLE_ELEMENTS);
+        free(msg);
+
+        snprintf(path, sizeof(path), "/mixer/ch%d/{fader,pan}", nch / 2);
+        packet = make_message(path, LOP_FLOAT, &size);
+        bench_case("single wildcard {fader,pan} ,f", n, s, packet, size, 1);
+        packet = make_message("/mixer/*/fader", LOP_FLOAT, &size);
+        bench_case("single wildcard /mixer/*/fader ,f", n, s, packet, size, 1);
+        packet = make_message("/mixer/*/fader", LOP_INT32, &size);
+        bench_case("single wildcard coerced ,i->f", n, s, packet, size, 1);
+
+        lop_server_free(s);
+
+        s = make_server(n, 1);
+        snprintf(path, sizeof(path), "/mixer/ch%d/fader", nch / 2);
+        packet = make_message(path, LOP_INT32, &size);
+        bench_case("arena single exact coerced ,i->f", n, s, packet, size, 1);
+        packet = make_message("/mixer/*/fader", LOP_INT32, &size);
+        bench_case("arena single wildcard coerced ,i->f", n, s, packet, size,
+                   1);
+        lop_server_free(s);
+    }
+
+    bench_batch(1000, 0);
+    bench_batch(1000, 1);
+    bench_coerce(8);
+    bench_coerce(64);
+}
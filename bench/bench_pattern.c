@@ -0,0 +1,130 @@
+/*
+ *  Wildcard dispatch benchmarks over a control-surface namespace.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define PAGES 10
+
+static volatile int sink;
+
+typedef struct {
+    lop_server s;
+    char *packet;
+    size_t size;
+    char *buf;
+} pattern_case;
+
+static int handler(const char *path, const char *types, lop_arg **argv,
+    int argc, lop_message msg, void *user_data)
+{
+    sink += argc;
+    return 0;
+}
+
+static void add(lop_server s, const char *path, int *n)
+{
+    lop_server_add_method(s, path, "f", handler, NULL);
+    (*n)++;
+}
+
+/*
+ * A TouchOSC-style layout: PAGES pages of faders, toggles, push buttons,
+ * rotaries, multi-faders and XY pads, 1000 addresses per page.
+ */
+static lop_server make_server(int *n)
+{
+    lop_server s = lop_server_new(NULL, NULL, NULL);
+    char path[64];
+    int p, i, j;
+
+    *n = 0;
+    for (p = 1; p <= PAGES; p++) {
+        for (i = 1; i <= 100; i++) {
+            snprintf(path, sizeof(path), "/%d/fader%d", p, i);
+            add(s, path, n);
+            snprintf(path, sizeof(path), "/%d/toggle%d", p, i);
+            add(s, path, n);
+            snprintf(path, sizeof(path), "/%d/push%d", p, i);
+            add(s, path, n);
+            snprintf(path, sizeof(path), "/%d/rotary%d", p, i);
+            add(s, path, n);
+            for (j = 1; j <= 2; j++) {
+                snprintf(path, sizeof(path), "/%d/multixy%d/%d", p, i, j);
+                add(s, path, n);
+            }
+        }
+        for (i = 1; i <= 10; i++) {
+            for (j = 1; j <= 40; j++) {
+                snprintf(path, sizeof(path), "/%d/multifader%d/%d", p, i, j);
+                add(s, path, n);
+            }
+        }
+    }
+    return s;
+}
+
+static void run_dispatch(void *arg)
+{
+    pattern_case *c = arg;
+
+    memcpy(c->buf, c->packet, c->size);
+    lop_server_dispatch_data(c->s, c->buf, c->size);
+}
+
+void bench_wildcard(void)
+{
+    static const char *patterns[] = {
+        "/5/fader50",
+        "/1/fader*",
+        "/[1-3]/toggle1",
+        "/*/push5",
+        "/2/multifader3/*",
+        "/5/multixy{1,2}/1",
+        "/?/rotary10",
+        "/*/*/40",
+    };
+    pattern_case c;
+    lop_message m;
+    unsigned i;
+    int n;
+
+    bench_header("wildcard");
+    c.s = make_server(&n);
+    m = lop_message_new();
+    lop_message_add_float(m, 0.5f);
+    for (i = 0; i < sizeof(patterns) / sizeof(patterns[0]); i++) {
+        char name[64];
+
+        c.packet = lop_message_serialise(m, patterns[i], NULL, &c.size);
+        c.buf = malloc(c.size);
+        snprintf(name, sizeof(name), "single %s ,f", patterns[i]);
+        bench_run(name, n, run_dispatch, &c, 1);
+        free(c.buf);
+        free(c.packet);
+    }
+    lop_message_free(m);
+    {
+        unsigned long hits, misses;
+
+        lop_server_dispatch_cache_stats(c.s, &hits, &misses);
+        printf("dispatch cache: %lu hits, %lu misses\n", hits, misses);
+        lop_server_pattern_cache_stats(c.s, &hits, &misses);
+        printf("pattern cache: %lu hits, %lu misses\n", hits, misses);
+    }
+    lop_server_free(c.s);
+}
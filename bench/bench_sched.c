@@ -0,0 +1,184 @@
+/*
+ *  Scheduler benchmarks: timetagged bundles queued for later dispatch.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+#include "lop/lop_endian.h"
+
+#define EVENTS 100000
+
+/* Distinct timetags; the events sharing one must keep their order */
+#define SLOTS 1000
+
+typedef struct {
+    char *packets;
+    size_t size;
+    uint64_t last;
+    int last_index;
+    int dispatched;
+    int misordered;
+} sched_case;
+
+static sched_case sc;
+
+static int handler(const char *path, const char *types, lop_arg **argv,
+    int argc, lop_message msg, void *user_data)
+{
+    uint64_t t = lop_timetag_to_fixed(lop_message_get_timestamp(msg));
+    int index = argv[0]->i;
+
+    if (sc.dispatched && (t < sc.last ||
+                          (t == sc.last && index < sc.last_index))) {
+        sc.misordered++;
+    }
+    sc.last = t;
+    sc.last_index = index;
+    sc.dispatched++;
+    return 0;
+}
+
+/*
+ * Build EVENTS one-message bundles, event i due at start + slot * step
+ * for a pseudo-random slot, all packed into sc.packets. Returns the
+ * latest timetag used.
+ */
+static lop_timetag make_packets(lop_timetag start, uint32_t step)
+{
+    lop_message m = lop_message_new();
+    lop_timetag latest = start;
+    size_t msg_size;
+    char *pos;
+    int i;
+
+    lop_message_add_int32(m, 0);
+    msg_size = lop_message_length(m, "/cue");
+    sc.size = 16 + 4 + msg_size;
+    sc.packets = malloc((size_t)EVENTS * sc.size);
+    pos = sc.packets;
+    for (i = 0; i < EVENTS; i++) {
+        lop_timetag t = lop_timetag_add(start,
+                                        (int64_t)((i * 7919u) % SLOTS) * step);
+
+        if (lop_timetag_cmp(t, latest) > 0) {
+            latest = t;
+        }
+
+        lop_message_get_argv(m)[0]->i = i;
+        memcpy(pos, "#bundle\0", 8);
+        *(uint32_t *)(pos + 8) = lop_htoo32(t.sec);
+        *(uint32_t *)(pos + 12) = lop_htoo32(t.frac);
+        *(uint32_t *)(pos + 16) = lop_htoo32(msg_size);
+        lop_message_serialise(m, "/cue", pos + 20, NULL);
+        pos += sc.size;
+    }
+    lop_message_free(m);
+    return latest;
+}
+
+static uint64_t schedule_all(lop_server s)
+{
+    uint64_t start;
+    int i;
+
+    start = bench_now_ns();
+    for (i = 0; i < EVENTS; i++) {
+        lop_server_dispatch_data(s, sc.packets + i * sc.size, sc.size);
+    }
+    return bench_now_ns() - start;
+}
+
+static lop_server make_server(int arena)
+{
+    lop_server s = lop_server_new(NULL, NULL, NULL);
+
+    lop_server_add_method(s, "/cue", "i", handler, NULL);
+    if (arena) {
+        lop_server_enable_arena(s, 0);
+    }
+    memset(&sc, 0, sizeof(sc));
+    return s;
+}
+
+void bench_sched(void)
+{
+    int arena;
+
+    bench_header("sched");
+    for (arena = 0; arena <= 1; arena++) {
+        const char *prefix = arena ? "arena " : "";
+        lop_timetag now, latest;
+        lop_server s;
+        uint64_t elapsed, allocs;
+        char name[64];
+
+        /* far enough ahead that nothing falls due while queueing */
+        s = make_server(arena);
+        lop_timetag_now(&now);
+        now.sec += 60;
+        make_packets(now, 1u << 22);
+        bench_alloc_reset();
+        elapsed = schedule_all(s);
+        allocs = bench_alloc_count();
+        snprintf(name, sizeof(name), "%squeue future bundle", prefix);
+        bench_report(name, EVENTS, elapsed, EVENTS, allocs);
+        lop_server_free(s);
+        free(sc.packets);
+
+        /* due in a second, then dispatched by a single call */
+        s = make_server(arena);
+        lop_timetag_now(&now);
+        now.sec += 1;
+        latest = make_packets(now, 1u << 12);
+        schedule_all(s);
+        do {
+            lop_timetag_now(&now);
+        } while (lop_timetag_cmp(now, latest) <= 0);
+        bench_alloc_reset();
+        elapsed = bench_now_ns();
+        lop_server_dispatch_data(s, NULL, 0);
+        elapsed = bench_now_ns() - elapsed;
+        allocs = bench_alloc_count();
+        snprintf(name, sizeof(name), "%sdispatch due events", prefix);
+        bench_report(name, EVENTS, elapsed, EVENTS, allocs);
+        if (sc.dispatched != EVENTS || sc.misordered) {
+            printf("  ERROR: %d of %d dispatched, %d out of order\n",
+                   sc.dispatched, EVENTS, sc.misordered);
+        }
+        lop_server_free(s);
+        free(sc.packets);
+
+        /* eight minutes of events replayed on virtual time, without waiting */
+        s = make_server(arena);
+        lop_timetag_now(&now);
+        lop_server_set_virtual_time(s, now);
+        latest = make_packets(now, 1u << 31);
+        schedule_all(s);
+        bench_alloc_reset();
+        elapsed = bench_now_ns();
+        lop_server_advance_time(s, latest);
+        elapsed = bench_now_ns() - elapsed;
+        allocs = bench_alloc_count();
+        snprintf(name, sizeof(name), "%sreplay on virtual time", prefix);
+        bench_report(name, EVENTS, elapsed, EVENTS, allocs);
+        if (sc.dispatched != EVENTS || sc.misordered) {
+            printf("  ERROR: %d of %d dispatched, %d out of order\n",
+                   sc.dispatched, EVENTS, sc.misordered);
+        }
+        lop_server_free(s);
+        free(sc.packets);
+    }
+}
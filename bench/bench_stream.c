@@ -0,0 +1,220 @@
+/*
+ *  Stream decoder benchmarks: OSC packets framed in a TCP byte stream.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#define PACKETS 20000
+
+typedef struct {
+    char *data;
+    size_t size;
+} stream_data;
+
+static stream_data plain, length, slip;
+static size_t *packet_sizes;
+static long received;
+
+static int handler(const char *path, const char *types, lop_arg **argv,
+    int argc, lop_message msg, void *user_data)
+{
+    received++;
+    return 0;
+}
+
+static void append(stream_data *sd, const void *data, size_t size)
+{
+    memcpy(sd->data + sd->size, data, size);
+    sd->size += size;
+}
+
+/* A mix of small control messages and larger ones carrying blobs, whose
+ * bytes include the SLIP specials */
+static void make_streams(void)
+{
+    unsigned char blob_data[200];
+    lop_blob blob;
+    size_t cap = 0;
+    int i;
+
+    for (i = 0; i < (int)sizeof(blob_data); i++) {
+        blob_data[i] = (unsigned char)(i * 37);
+    }
+    blob = lop_blob_new(sizeof(blob_data), blob_data);
+    packet_sizes = malloc(PACKETS * sizeof(size_t));
+
+    for (i = 0; i < 2; i++) {
+        int n;
+
+        plain.size = length.size = slip.size = 0;
+        for (n = 0; n < PACKETS; n++) {
+            lop_message m = lop_message_new();
+            char path[32];
+            size_t size, j;
+            char *p;
+
+            snprintf(path, sizeof(path), "/synth/%d/freq", n % 64);
+            lop_message_add_float(m, 440.0f + n);
+            if (n % 4 == 0) {
+                lop_message_add_string(m, "attack");
+                lop_message_add_blob(m, blob);
+            }
+            size = lop_message_length(m, path);
+            if (!i) {
+                /* first pass only measures */
+                cap += size * 2 + 8;
+                lop_message_free(m);
+                continue;
+            }
+            p = lop_message_serialise(m, path, NULL, NULL);
+            packet_sizes[n] = size;
+            append(&plain, p, size);
+
+            {
+                unsigned char prefix[4] = {
+                    size >> 24, size >> 16, size >> 8, size
+                };
+                append(&length, prefix, 4);
+                append(&length, p, size);
+            }
+
+            for (j = 0; j < size; j++) {
+                unsigned char c = p[j], esc[2] = { 0xdb, 0 };
+
+                if (c == 0xc0 || c == 0xdb) {
+                    esc[1] = c == 0xc0 ? 0xdc : 0xdd;
+                    append(&slip, esc, 2);
+                } else {
+                    append(&slip, &c, 1);
+                }
+            }
+            append(&slip, "\xc0", 1);
+            free(p);
+            lop_message_free(m);
+        }
+        if (!i) {
+            plain.data = malloc(cap);
+            length.data = malloc(cap);
+            slip.data = malloc(cap);
+        }
+    }
+    lop_blob_free(blob);
+}
+
+static void report(const char *name, size_t chunk, size_t bytes,
+    uint64_t elapsed, long packets, uint64_t allocs)
+{
+    printf("%-32s %8lu %10.0f %10.1f %12.2f\n", name, (unsigned long)chunk,
+           bytes * 1e3 / elapsed, (double)elapsed / packets,
+           (double)allocs / packets);
+    if (received != packets) {
+        printf("  ERROR: %ld of %ld packets dispatched\n", received,
+               packets);
+    }
+    fflush(stdout);
+}
+
+/* Feed the stream in chunk byte pieces until bench_min_time is spent.
+ * The decoder works in place, so each round starts from a fresh copy. */
+static void run_stream(const char *name, lop_server s,
+    lop_stream_framing framing, const stream_data *sd, size_t chunk)
+{
+    uint64_t limit = (uint64_t)(bench_min_time * 1e9), elapsed = 0;
+    uint64_t allocs = 0;
+    char *work = malloc(sd->size);
+    lop_stream st = lop_stream_new(s, framing, 0);
+    size_t bytes = 0;
+    long packets = 0;
+
+    received = 0;
+    do {
+        uint64_t start;
+        size_t off;
+
+        memcpy(work, sd->data, sd->size);
+        bench_alloc_reset();
+        start = bench_now_ns();
+        for (off = 0; off < sd->size; off += chunk) {
+            size_t n = sd->size - off < chunk ? sd->size - off : chunk;
+
+            lop_stream_feed(st, work + off, n);
+        }
+        elapsed += bench_now_ns() - start;
+        allocs += bench_alloc_count();
+        bytes += sd->size;
+        packets += PACKETS;
+    } while (elapsed < limit);
+
+    report(name, chunk, bytes, elapsed, packets, allocs);
+    lop_stream_free(st);
+    free(work);
+}
+
+/* What callers did before: reassemble each packet into a second buffer
+ * and dispatch it from there */
+static void run_reassemble(lop_server s)
+{
+    uint64_t limit = (uint64_t)(bench_min_time * 1e9), elapsed = 0;
+    char *packet = malloc(65536);
+    size_t bytes = 0;
+    long packets = 0;
+
+    received = 0;
+    do {
+        uint64_t start = bench_now_ns();
+        size_t off = 0;
+        int n;
+
+        for (n = 0; n < PACKETS; n++) {
+            memcpy(packet, plain.data + off, packet_sizes[n]);
+            lop_server_dispatch_data(s, packet, packet_sizes[n]);
+            off += packet_sizes[n];
+        }
+        elapsed += bench_now_ns() - start;
+        bytes += length.size;
+        packets += PACKETS;
+    } while (elapsed < limit);
+
+    report("reassemble and dispatch", 0, bytes, elapsed, packets, 0);
+    free(packet);
+}
+
+void bench_stream(void)
+{
+    static const size_t chunks[] = { 1460, 65536 };
+    lop_server s = lop_server_new(NULL, NULL, NULL);
+    unsigned int i;
+
+    lop_server_add_method(s, NULL, NULL, handler, NULL);
+    make_streams();
+
+    printf("\n== stream\n");
+    printf("%-32s %8s %10s %10s %12s\n", "case", "chunk", "MB/s", "ns/pkt",
+           "allocs/pkt");
+    run_reassemble(s);
+    for (i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        run_stream("length prefix", s, LOP_STREAM_LENGTH, &length,
+                   chunks[i]);
+        run_stream("slip", s, LOP_STREAM_SLIP, &slip, chunks[i]);
+    }
+
+    lop_server_free(s);
+    free(plain.data);
+    free(length.data);
+    free(slip.data);
+    free(packet_sizes);
+}
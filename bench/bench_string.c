@@ -0,0 +1,164 @@
+/*
+ *  String validation benchmarks: OSC paths, typetags and string args.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bench.h"
+
+#if defined(__AVX2__)
+#define SCAN "avx2"
+#elif defined(__SSE2__)
+#define SCAN "sse2"
+#elif defined(__ARM_NEON)
+#define SCAN "neon"
+#else
+#define SCAN "word"
+#endif
+
+/* Internal to the library, see lop_internal.h */
+ssize_t lop_validate_string(void *data, ssize_t size);
+
+#define DIFF_CASES 1000000
+#define DIFF_BUF 300
+
+/* The byte at a time validator lop_validate_string() replaced, kept as
+ * the reference for the differential check */
+static ssize_t ref_validate_string(void *data, ssize_t size)
+{
+    ssize_t i = 0, len = 0;
+    char *pos = data;
+
+    if (size < 0) {
+        return -LOP_ESIZE;
+    }
+    for (i = 0; i < size; ++i) {
+        if (pos[i] == '\0') {
+            len = 4 * (i / 4 + 1);
+            break;
+        }
+    }
+    if (0 == len) {
+        return -LOP_ETERM;
+    }
+    if (len > size) {
+        return -LOP_ESIZE;
+    }
+    for (; i < len; ++i) {
+        if (pos[i] != '\0') {
+            return -LOP_EPAD;
+        }
+    }
+    return len;
+}
+
+/*
+ * Compare both validators on random strings: random lengths, offsets
+ * (so every alignment is covered), sizes cutting the string or its
+ * padding short, and stray bytes in the padding. The buffer is copied
+ * to an exactly sized allocation so that reads past size would show up
+ * under a memory checker.
+ */
+static void differential(void)
+{
+    unsigned char buf[DIFF_BUF];
+    unsigned int seed = 1;
+    long mismatches = 0;
+    int n;
+
+#define RAND() (seed = seed * 1103515245 + 12345, (seed >> 8) & 0xffff)
+    for (n = 0; n < DIFF_CASES; n++) {
+        int len = RAND() % 260, off = RAND() % 8, size, i;
+        char *copy;
+        ssize_t got, want;
+
+        for (i = 0; i < DIFF_BUF; i++) {
+            /* mostly printable, sometimes 0x80 or above */
+            buf[i] = RAND() % 16 ? 'a' + RAND() % 26 : 0x80 + RAND() % 128;
+        }
+        if (RAND() % 8) {
+            buf[off + len] = 0;
+            /* usually well formed padding */
+            for (i = off + len + 1; i < off + (len / 4 + 1) * 4; i++) {
+                buf[i] = RAND() % 16 ? 0 : 'x';
+            }
+        }
+        size = RAND() % 6 ? (len / 4 + 1) * 4 + RAND() % 8 - 2 : RAND() % 300;
+        if (size < 0) {
+            size = 0;
+        }
+        if (off + size > DIFF_BUF) {
+            size = DIFF_BUF - off;
+        }
+        copy = malloc(size ? size : 1);
+        memcpy(copy, buf + off, size);
+        got = lop_validate_string(copy, size);
+        want = ref_validate_string(copy, size);
+        if (got != want) {
+            if (!mismatches) {
+                printf("  ERROR: len %d size %d: got %ld, want %ld\n", len,
+                       size, (long)got, (long)want);
+            }
+            mismatches++;
+        }
+        free(copy);
+    }
+#undef RAND
+    printf("differential check, %d cases (%s scan): %ld mismatches\n",
+           DIFF_CASES, SCAN, mismatches);
+}
+
+typedef struct {
+    char *data;
+    ssize_t size;
+    ssize_t (*validate)(void *data, ssize_t size);
+} string_case;
+
+static volatile ssize_t sink;
+
+static void run_validate(void *arg)
+{
+    string_case *c = arg;
+
+    sink += c->validate(c->data, c->size);
+}
+
+void bench_string(void)
+{
+    /* a typetag, short and long paths, a file name, a text argument */
+    static const int lengths[] = { 3, 7, 17, 31, 63, 250 };
+    unsigned int i;
+
+    bench_header("string");
+    differential();
+    for (i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        int len = lengths[i];
+        string_case c;
+        char name[64];
+
+        /* the string, its padding and a message's worth of arguments */
+        c.size = (len / 4 + 1) * 4 + 16;
+        c.data = calloc(1, c.size);
+        memset(c.data, 'a', len);
+
+        c.validate = ref_validate_string;
+        snprintf(name, sizeof(name), "byte at a time, %d chars", len);
+        bench_run(name, len, run_validate, &c, 1);
+        c.validate = lop_validate_string;
+        snprintf(name, sizeof(name), "%s, %d chars", SCAN, len);
+        bench_run(name, len, run_validate, &c, 1);
+        free(c.data);
+    }
+}
@@ -0,0 +1,163 @@
+/*
+ *  Deadline benchmarks: how late scheduled bundles are dispatched.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "lop/lop_endian.h"
+
+#define EVENTS 300
+
+/* Upper bounds of the lateness histogram buckets, in ns */
+static const int64_t buckets[] = {
+    1000, 10000, 50000, 100000, 500000, 1000000, INT64_MAX
+};
+static const char *bucket_names[] = {
+    "<1us", "<10us", "<50us", "<100us", "<500us", "<1ms", ">=1ms"
+};
+#define NBUCKETS (sizeof(buckets) / sizeof(buckets[0]))
+
+static int64_t lateness[EVENTS];
+static int dispatched;
+/* waits that returned without dispatching anything */
+static int empty_waits;
+
+static int handler(const char *path, const char *types, lop_arg **argv,
+    int argc, lop_message msg, void *user_data)
+{
+    lop_timetag now;
+
+    lop_clock_monotonic(&now, NULL);
+    if (dispatched < EVENTS) {
+        lateness[dispatched++] =
+            lop_timetag_diff_ns(now, lop_message_get_timestamp(msg));
+    }
+    return 0;
+}
+
+static int cmp_ns(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Queue EVENTS one-message bundles, 1 to 3 ms apart */
+static lop_server make_server(void)
+{
+    lop_server s = lop_server_new(NULL, NULL, NULL);
+    lop_message m = lop_message_new();
+    size_t msg_size, size;
+    lop_timetag t;
+    char *packet;
+    int i;
+
+    lop_server_add_method(s, "/cue", "i", handler, NULL);
+    lop_server_set_clock(s, lop_clock_monotonic, NULL);
+    lop_message_add_int32(m, 0);
+    msg_size = lop_message_length(m, "/cue");
+    size = 20 + msg_size;
+    packet = malloc(size);
+
+    lop_clock_monotonic(&t, NULL);
+    t = lop_timetag_add_ns(t, 5000000);
+    for (i = 0; i < EVENTS; i++) {
+        t = lop_timetag_add_ns(t, 1000000 + (i * 7919) % 2000000);
+        lop_message_get_argv(m)[0]->i = i;
+        memcpy(packet, "#bundle\0", 8);
+        *(uint32_t *)(packet + 8) = lop_htoo32(t.sec);
+        *(uint32_t *)(packet + 12) = lop_htoo32(t.frac);
+        *(uint32_t *)(packet + 16) = lop_htoo32(msg_size);
+        lop_message_serialise(m, "/cue", packet + 20, NULL);
+        lop_server_dispatch_data(s, packet, size);
+    }
+    free(packet);
+    lop_message_free(m);
+    dispatched = 0;
+    empty_waits = 0;
+    return s;
+}
+
+static void report(const char *name)
+{
+    int counts[NBUCKETS];
+    unsigned int b;
+    int i;
+
+    memset(counts, 0, sizeof(counts));
+    for (i = 0; i < dispatched; i++) {
+        for (b = 0; lateness[i] >= buckets[b]; b++)
+            ;
+        counts[b]++;
+    }
+    qsort(lateness, dispatched, sizeof(int64_t), cmp_ns);
+
+    printf("%-24s %8.1f %8.1f %8.1f ", name,
+           lateness[dispatched / 2] / 1000.0,
+           lateness[dispatched * 99 / 100] / 1000.0,
+           lateness[dispatched - 1] / 1000.0);
+    for (b = 0; b < NBUCKETS; b++) {
+        printf(" %6d", counts[b]);
+    }
+    printf("\n");
+    if (dispatched != EVENTS) {
+        printf("  ERROR: %d of %d dispatched\n", dispatched, EVENTS);
+    }
+    if (empty_waits) {
+        printf("  ERROR: %d waits returned before their event\n",
+               empty_waits);
+    }
+    fflush(stdout);
+}
+
+void bench_wait(void)
+{
+    static const unsigned int spins[] = { 0, 100, 200 };
+    lop_server s;
+    unsigned int b, i;
+    char name[64];
+
+    printf("\n== wait\n");
+    printf("%-24s %8s %8s %8s ", "case (lateness in us)", "p50", "p99",
+           "max");
+    for (b = 0; b < NBUCKETS; b++) {
+        printf(" %6s", bucket_names[b]);
+    }
+    printf("\n");
+
+    /* the loop callers had to write before */
+    s = make_server();
+    while (dispatched < EVENTS) {
+        usleep((useconds_t)(lop_server_next_event_delay(s) * 1e6));
+        lop_server_dispatch_data(s, NULL, 0);
+    }
+    report("poll and usleep");
+    lop_server_free(s);
+
+    for (i = 0; i < sizeof(spins) / sizeof(spins[0]); i++) {
+        s = make_server();
+        lop_server_set_wait_spin(s, spins[i]);
+        while (dispatched < EVENTS) {
+            if (lop_server_wait_until_next(s, -1) == 0) {
+                empty_waits++;
+            }
+        }
+        snprintf(name, sizeof(name), "wait, spin %uus", spins[i]);
+        report(name);
+        lop_server_free(s);
+    }
+}
@@ -0,0 +1,172 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+/*
+ * Bundle builder.
+ *
+ * A bundle is built in one buffer, front to back. Each element's size
+ * word is written as a placeholder, the element is serialised straight
+ * after it, and the word is filled in once the element's size is known:
+ * right away for a message, when it is closed for a nested bundle.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+#include "lop/lop_lowlevel.h"
+#include "lop/lop_endian.h"
+
+/* First size of a bundle's buffer unless told otherwise */
+#define LOP_DEF_BUNDLE_SIZE 256
+
+/* "#bundle", its padding and the timetag */
+#define BUNDLE_HEADER 16
+
+/* Make room for size more bytes */
+static int reserve(lop_bundle b, size_t size)
+{
+    size_t n = b->size;
+    char *data;
+
+    if (b->len + size <= b->size) {
+	return 0;
+    }
+    while (n < b->len + size) {
+	n *= 2;
+    }
+    data = realloc(b->data, n);
+    if (!data) {
+	return -1;
+    }
+    b->data = data;
+    b->size = n;
+    return 0;
+}
+
+static void put_header(char *to, lop_timetag tt)
+{
+    memcpy(to, "#bundle\0", 8);
+    *(uint32_t *)(to + 8) = lop_htoo32(tt.sec);
+    *(uint32_t *)(to + 12) = lop_htoo32(tt.frac);
+}
+
+/* Fill in the size word at offset with the bytes written after it */
+static void backpatch(lop_bundle b, size_t offset)
+{
+    *(uint32_t *)(b->data + offset) =
+	lop_htoo32((uint32_t)(b->len - offset - 4));
+}
+
+lop_bundle lop_bundle_new(lop_timetag tt, size_t size)
+{
+    lop_bundle b = calloc(1, sizeof(struct _lop_bundle));
+
+    if (!b) {
+	return NULL;
+    }
+    b->size = size > BUNDLE_HEADER ? size : LOP_DEF_BUNDLE_SIZE;
+    b->data = malloc(b->size);
+    if (!b->data) {
+	free(b);
+	return NULL;
+    }
+    put_header(b->data, tt);
+    b->len = BUNDLE_HEADER;
+    return b;
+}
+
+void lop_bundle_free(lop_bundle b)
+{
+    if (b) {
+	free(b->data);
+	free(b->open);
+	free(b);
+    }
+}
+
+void lop_bundle_reset(lop_bundle b, lop_timetag tt)
+{
+    put_header(b->data, tt);
+    b->len = BUNDLE_HEADER;
+    b->depth = 0;
+}
+
+int lop_bundle_add_message(lop_bundle b, const char *path, lop_message m)
+{
+    size_t start = b->len, len;
+
+    /* the size word, then as much room as is left */
+    if (reserve(b, 4)) {
+	return -1;
+    }
+    len = lop_message_serialise_into(m, path, b->data + start + 4,
+				     b->size - start - 4);
+    if (start + 4 + len > b->size) {
+	b->len = start + 4;
+	if (reserve(b, len)) {
+	    b->len = start;
+	    return -1;
+	}
+	lop_message_serialise_into(m, path, b->data + start + 4, len);
+    }
+    b->len = start + 4 + len;
+    backpatch(b, start);
+    return 0;
+}
+
+int lop_bundle_open(lop_bundle b, lop_timetag tt)
+{
+    if (b->depth == b->open_size) {
+	int n = b->open_size ? b->open_size * 2 : 4;
+	size_t *open = realloc(b->open, n * sizeof(size_t));
+
+	if (!open) {
+	    return -1;
+	}
+	b->open = open;
+	b->open_size = n;
+    }
+    if (reserve(b, 4 + BUNDLE_HEADER)) {
+	return -1;
+    }
+    b->open[b->depth++] = b->len;
+    put_header(b->data + b->len + 4, tt);
+    b->len += 4 + BUNDLE_HEADER;
+    return 0;
+}
+
+int lop_bundle_close(lop_bundle b)
+{
+    if (!b->depth) {
+	return -1;
+    }
+    backpatch(b, b->open[--b->depth]);
+    return 0;
+}
+
+void *lop_bundle_data(lop_bundle b, size_t *size)
+{
+    while (b->depth) {
+	lop_bundle_close(b);
+    }
+    if (size) {
+	*size = b->len;
+    }
+    return b->data;
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
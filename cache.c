@@ -0,0 +1,176 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+
+typedef struct _lop_cache_entry {
+    struct _lop_cache_entry *hash_next;
+    /* recency list, most recently used first */
+    struct _lop_cache_entry *prev;
+    struct _lop_cache_entry *next;
+    uint32_t hash;
+    size_t keylen;
+    void *value;
+} lop_cache_entry;
+
+#define entry_key(e) ((char *)((e) + 1))
+
+static uint32_t cache_hash(const char *key, size_t len)
+{
+    uint32_t h = 2166136261u;
+
+    while (len--) {
+	h = (h ^ (unsigned char)*key++) * 16777619u;
+    }
+    return h;
+}
+
+int lop_cache_init(lop_cache *c, unsigned int capacity,
+    void (*free_value)(void *value))
+{
+    memset(c, 0, sizeof(lop_cache));
+    c->capacity = capacity;
+    c->free_value = free_value;
+    if (!capacity) {
+	return 0;
+    }
+
+    /* keep the load factor at or below one half */
+    c->table_size = 1;
+    while (c->table_size < 2 * capacity) {
+	c->table_size *= 2;
+    }
+    c->table = calloc(c->table_size, sizeof(lop_cache_entry *));
+    if (!c->table) {
+	c->capacity = c->table_size = 0;
+	return -1;
+    }
+    return 0;
+}
+
+static void list_unlink(lop_cache *c, lop_cache_entry *e)
+{
+    if (e->prev) {
+	e->prev->next = e->next;
+    } else {
+	c->head = e->next;
+    }
+    if (e->next) {
+	e->next->prev = e->prev;
+    } else {
+	c->tail = e->prev;
+    }
+}
+
+static void list_push(lop_cache *c, lop_cache_entry *e)
+{
+    e->prev = NULL;
+    e->next = c->head;
+    if (c->head) {
+	c->head->prev = e;
+    } else {
+	c->tail = e;
+    }
+    c->head = e;
+}
+
+static void entry_remove(lop_cache *c, lop_cache_entry *e)
+{
+    lop_cache_entry **link = &c->table[e->hash & (c->table_size - 1)];
+
+    while (*link != e) {
+	link = &(*link)->hash_next;
+    }
+    *link = e->hash_next;
+    list_unlink(c, e);
+    c->count--;
+    if (c->free_value) {
+	c->free_value(e->value);
+    }
+    free(e);
+}
+
+void *lop_cache_get(lop_cache *c, const char *key, size_t len)
+{
+    lop_cache_entry *e;
+    uint32_t hash;
+
+    if (!c->capacity) {
+	return NULL;
+    }
+    hash = cache_hash(key, len);
+    for (e = c->table[hash & (c->table_size - 1)]; e; e = e->hash_next) {
+	if (e->hash == hash && e->keylen == len &&
+	    !memcmp(entry_key(e), key, len)) {
+	    if (e != c->head) {
+		list_unlink(c, e);
+		list_push(c, e);
+	    }
+	    c->hits++;
+	    return e->value;
+	}
+    }
+    c->misses++;
+    return NULL;
+}
+
+int lop_cache_put(lop_cache *c, const char *key, size_t len, void *value)
+{
+    lop_cache_entry *e, **bucket;
+
+    if (!c->capacity) {
+	return -1;
+    }
+    e = malloc(sizeof(lop_cache_entry) + len);
+    if (!e) {
+	return -1;
+    }
+    if (c->count == c->capacity) {
+	entry_remove(c, c->tail);
+    }
+
+    e->hash = cache_hash(key, len);
+    e->keylen = len;
+    e->value = value;
+    memcpy(entry_key(e), key, len);
+    bucket = &c->table[e->hash & (c->table_size - 1)];
+    e->hash_next = *bucket;
+    *bucket = e;
+    list_push(c, e);
+    c->count++;
+    return 0;
+}
+
+void lop_cache_clear(lop_cache *c)
+{
+    while (c->head) {
+	entry_remove(c, c->head);
+    }
+}
+
+void lop_cache_free(lop_cache *c)
+{
+    if (c->table) {
+	lop_cache_clear(c);
+	free(c->table);
+	c->table = NULL;
+    }
+    c->capacity = c->table_size = 0;
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
@@ -0,0 +1,379 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+/*
+ * Coercion plans.
+ *
+ * The first time a method is offered a typetag other than its own, the
+ * argument types are checked once and turned into a list of conversions.
+ * Arguments that are already of the right type, or are strings passed to
+ * a symbol (or the other way around), are handed over untouched; only the
+ * numeric ones are converted, each into an 8 byte slot of a buffer the
+ * caller provides.
+ *
+ * The same conversions fill the arrays of lop_message_get_floats() and
+ * friends.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+#include "lop/lop_lowlevel.h"
+
+/* Typetags remembered per method; older ones are dropped */
+#define LOP_METHOD_PLANS 8
+
+/*
+ * Casting a floating point value that is NaN or out of range to an
+ * integer is undefined, so those casts are clamped: NaN gives 0 and
+ * values beyond the integer's range its minimum or maximum. The int32
+ * clamp is written as selects, which still vectorise. int64 to int32
+ * keeps the low 32 bits, as C compilers define that cast.
+ */
+#define AS_FLOAT(v) ((float)(v))
+#define AS_DOUBLE(v) ((double)(v))
+#define AS_INT64(v) ((int64_t)(v))
+#define AS_INT32(v) ((int32_t)(v))
+
+static int32_t clamp_int32(double v)
+{
+    v = v == v ? v : 0.0;
+    v = v < 2147483647.0 ? v : 2147483647.0;
+    v = v > -2147483648.0 ? v : -2147483648.0;
+    return (int32_t)v;
+}
+
+/* The same for floats, without widening them so that a float array
+ * still converts in vectors of the same width */
+static int32_t clamp_float_int32(float v)
+{
+    /* 2147483520 is the largest float below 2^31 */
+    float c = v == v ? v : 0.0f;
+
+    c = c < 2147483520.0f ? c : 2147483520.0f;
+    c = c > -2147483648.0f ? c : -2147483648.0f;
+    return v >= 2147483648.0f ? INT32_MAX : (int32_t)c;
+}
+
+static int64_t clamp_int64(double v)
+{
+    if (v != v) {
+	return 0;
+    }
+    if (v >= 9223372036854775808.0) {
+	return INT64_MAX;
+    }
+    if (v <= -9223372036854775808.0) {
+	return INT64_MIN;
+    }
+    return (int64_t)v;
+}
+
+/*
+ * Each conversion comes in two forms: one argument, for lop_coerce(), and
+ * a run of arguments of the same type, for plans. The run form fills
+ * consecutive slots and points out[] at them in the same loop, which the
+ * compiler unrolls and, where the target has gathers, vectorises. Neither
+ * goes through lop_hires, which is x87 or software long double.
+ */
+#define CONVERTER(from, to, conv) \
+static void convert_##from##_##to(lop_arg *t, const lop_arg *f) \
+{ \
+    t->to = conv(f->from); \
+} \
+static void convert_run_##from##_##to(lop_arg *t, lop_arg **f, \
+    lop_arg **out, int n) \
+{ \
+    int k; \
+    for (k = 0; k < n; k++) { \
+	t[k].to = conv(f[k]->from); \
+	out[k] = t + k; \
+    } \
+}
+
+CONVERTER(i, h, AS_INT64)
+CONVERTER(i, f, AS_FLOAT)
+CONVERTER(i, d, AS_DOUBLE)
+CONVERTER(h, i, AS_INT32)
+CONVERTER(h, f, AS_FLOAT)
+CONVERTER(h, d, AS_DOUBLE)
+CONVERTER(f, i, clamp_int32)
+CONVERTER(f, h, clamp_int64)
+CONVERTER(f, d, AS_DOUBLE)
+CONVERTER(d, i, clamp_int32)
+CONVERTER(d, h, clamp_int64)
+CONVERTER(d, f, AS_FLOAT)
+
+/* Converters by [from][to], indexed as lop_type_table numbers them */
+static const lop_convert_fn converters[4][4] = {
+    { NULL, convert_i_h, convert_i_f, convert_i_d },
+    { convert_h_i, NULL, convert_h_f, convert_h_d },
+    { convert_f_i, convert_f_h, NULL, convert_f_d },
+    { convert_d_i, convert_d_h, convert_d_f, NULL },
+};
+
+static const lop_convert_run_fn run_converters[4][4] = {
+    { NULL, convert_run_i_h, convert_run_i_f, convert_run_i_d },
+    { convert_run_h_i, NULL, convert_run_h_f, convert_run_h_d },
+    { convert_run_f_i, convert_run_f_h, NULL, convert_run_f_d },
+    { convert_run_d_i, convert_run_d_h, convert_run_d_f, NULL },
+};
+
+lop_convert_fn lop_coerce_converter(lop_type from, lop_type to)
+{
+    const lop_type_desc *f = lop_type_desc_of(from);
+    const lop_type_desc *t = lop_type_desc_of(to);
+
+    if (!f->numeric || !t->numeric) {
+	return NULL;
+    }
+    return converters[f->numeric - 1][t->numeric - 1];
+}
+
+static lop_coerce_plan *plan_build(const char *types, const char *spec)
+{
+    size_t len = strlen(types);
+    lop_coerce_step *last = NULL;
+    lop_convert_run_fn convert;
+    lop_coerce_plan *p;
+    size_t i;
+
+    p = malloc(sizeof(lop_coerce_plan) + len * sizeof(lop_coerce_step) +
+	       len + 1);
+    if (!p) {
+	return NULL;
+    }
+    p->steps = (lop_coerce_step *)(p + 1);
+    p->types = (char *)(p->steps + len);
+    memcpy(p->types, types, len + 1);
+    p->nsteps = 0;
+    p->nslots = 0;
+    p->ok = strlen(spec) == len;
+
+    for (i = 0; p->ok && i < len; i++) {
+	const lop_type_desc *from = lop_type_desc_of(types[i]);
+	const lop_type_desc *to = lop_type_desc_of(spec[i]);
+
+	if (types[i] == spec[i] ||
+	    (from->flags & to->flags & LOP_TYPE_STRING)) {
+	    continue;
+	}
+	if (!from->numeric || !to->numeric) {
+	    p->ok = 0;
+	    break;
+	}
+	convert = run_converters[from->numeric - 1][to->numeric - 1];
+	if (p->nsteps && last->convert == convert &&
+	    last->arg + last->count == (int)i) {
+	    /* same conversion as the argument before: extend its run */
+	    last->count++;
+	} else {
+	    last = p->steps + p->nsteps++;
+	    last->arg = i;
+	    last->dst = p->nslots;
+	    last->count = 1;
+	    last->convert = convert;
+	}
+	p->nslots++;
+    }
+    return p;
+}
+
+/*
+ * Copying numeric arguments out of a message into an array. A message's
+ * data is in host byte order once it is built or parsed, and arguments of
+ * one type lie back to back, so each run of them is converted by an array
+ * loop. Blocks of eight are loaded into a local array first, which tells
+ * the compiler they cannot overlap the output, so that it vectorises the
+ * conversion at -O2 too. 8 byte arguments are only 4 byte aligned in OSC
+ * data, hence the memcpy loads.
+ */
+#define COPY_BLOCK 8
+
+#define COPIER(name, from_type, to_type, conv) \
+static void name(void *to, const char *from, int n) \
+{ \
+    from_type v[COPY_BLOCK]; \
+    to_type *t = to; \
+    int k = 0, j; \
+    for (; n - k >= COPY_BLOCK; k += COPY_BLOCK) { \
+	memcpy(v, from + (size_t)k * sizeof(v[0]), sizeof(v)); \
+	for (j = 0; j < COPY_BLOCK; j++) { \
+	    t[k + j] = conv(v[j]); \
+	} \
+    } \
+    for (; k < n; k++) { \
+	memcpy(v, from + (size_t)k * sizeof(v[0]), sizeof(v[0])); \
+	t[k] = conv(v[0]); \
+    } \
+}
+
+COPIER(copy_i_f, int32_t, float, AS_FLOAT)
+COPIER(copy_i_d, int32_t, double, AS_DOUBLE)
+COPIER(copy_i_i, int32_t, int32_t, AS_INT32)
+COPIER(copy_h_f, int64_t, float, AS_FLOAT)
+COPIER(copy_h_d, int64_t, double, AS_DOUBLE)
+COPIER(copy_h_i, int64_t, int32_t, AS_INT32)
+COPIER(copy_f_f, float, float, AS_FLOAT)
+COPIER(copy_f_d, float, double, AS_DOUBLE)
+COPIER(copy_f_i, float, int32_t, clamp_float_int32)
+COPIER(copy_d_f, double, float, AS_FLOAT)
+COPIER(copy_d_d, double, double, AS_DOUBLE)
+COPIER(copy_d_i, double, int32_t, clamp_int32)
+
+typedef void (*copy_fn)(void *to, const char *from, int n);
+
+enum { COPY_FLOAT, COPY_DOUBLE, COPY_INT32 };
+
+/* Copiers by [from][to], from as lop_type_table numbers it */
+static const copy_fn copiers[4][3] = {
+    { copy_i_f, copy_i_d, copy_i_i },
+    { copy_h_f, copy_h_d, copy_h_i },
+    { copy_f_f, copy_f_d, copy_f_i },
+    { copy_d_f, copy_d_d, copy_d_i },
+};
+
+/* Count the arguments from types[i] on, up to end, of the same type as
+ * types[i], comparing eight typetag characters at a time */
+static int run_length(const char *types, int i, int end)
+{
+    const uint64_t same = 0x0101010101010101ULL * (unsigned char)types[i];
+    int run = 1;
+
+    while (end - (i + run) >= 8) {
+	uint64_t x;
+
+	memcpy(&x, types + i + run, 8);
+	if (x != same) {
+	    break;
+	}
+	run += 8;
+    }
+    while (i + run < end && types[i + run] == types[i]) {
+	run++;
+    }
+    return run;
+}
+
+static int get_numeric(lop_message m, int first, int count, char *out,
+    size_t width, int to)
+{
+    const char *types = m->types + 1;
+    int argc = m->typelen - 1;
+    char *ptr = m->data;
+    int i, end, n = 0;
+
+    if (first < 0 || first > argc) {
+	return -1;
+    }
+    end = count < 0 || count > argc - first ? argc : first + count;
+    for (i = 0; i < first; i++) {
+	ptr += lop_arg_size(types[i], ptr);
+    }
+    while (i < end) {
+	const lop_type_desc *t = lop_type_desc_of(types[i]);
+	int run;
+
+	if (!t->numeric) {
+	    ptr += lop_arg_size(types[i], ptr);
+	    i++;
+	    continue;
+	}
+	run = run_length(types, i, end);
+	copiers[t->numeric - 1][to](out + n * width, ptr, run);
+	ptr += run * t->size;
+	n += run;
+	i += run;
+    }
+    return n;
+}
+
+int lop_message_get_floats(lop_message m, int first, int count, float *out)
+{
+    return get_numeric(m, first, count, (char *)out, sizeof(float),
+		       COPY_FLOAT);
+}
+
+int lop_message_get_doubles(lop_message m, int first, int count,
+    double *out)
+{
+    return get_numeric(m, first, count, (char *)out, sizeof(double),
+		       COPY_DOUBLE);
+}
+
+int lop_message_get_int32s(lop_message m, int first, int count,
+    int32_t *out)
+{
+    return get_numeric(m, first, count, (char *)out, sizeof(int32_t),
+		       COPY_INT32);
+}
+
+lop_coerce_plan *lop_coerce_plan_get(lop_method m, const char *types)
+{
+    lop_coerce_plan *p, **link;
+    int n = 0;
+
+    for (link = &m->plans; (p = *link); link = &p->next, n++) {
+	if (!strcmp(p->types, types)) {
+	    if (n) {
+		/* move to the front, where the next lookup starts */
+		*link = p->next;
+		p->next = m->plans;
+		m->plans = p;
+	    }
+	    return p;
+	}
+	if (n == LOP_METHOD_PLANS - 1) {
+	    /* p is the oldest of a full list */
+	    *link = NULL;
+	    free(p);
+	    break;
+	}
+    }
+
+    p = plan_build(types, m->typespec);
+    if (p) {
+	p->next = m->plans;
+	m->plans = p;
+    }
+    return p;
+}
+
+void lop_coerce_run(const lop_coerce_step *steps, int nsteps,
+    lop_arg **argv, int argc, lop_arg **out, void *data)
+{
+    const lop_coerce_step *st = steps, *end = steps + nsteps;
+    lop_arg *slots = data;
+
+    memcpy(out, argv, argc * sizeof(lop_arg *));
+    for (; st < end; st++) {
+	st->convert(slots + st->dst, argv + st->arg, out + st->arg, st->count);
+    }
+}
+
+void lop_coerce_plans_free(lop_method m)
+{
+    lop_coerce_plan *p, *next;
+
+    for (p = m->plans; p; p = next) {
+	next = p->next;
+	free(p);
+    }
+    m->plans = NULL;
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
@@ -17,7 +17,6 @@
 #ifndef LOP_ENDIAN_H
 #define LOP_ENDIAN_H
 
-#include <rtems/endian.h>
 #include <sys/types.h>
 #include <stdint.h>
 
@@ -25,76 +24,61 @@
 extern "C" {
 #endif
 
-#define lop_swap16(x) htons(x)
+/* Target byte order, detected at compile time. OSC is bigendian, so on
+ * bigendian targets (eg. LM32) all of the conversions below vanish. */
 
-#define lop_swap32(x) htonl(x)
+#if defined(__BYTE_ORDER__) && defined(__ORDER_BIG_ENDIAN__)
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define LOP_BIGENDIAN 1
+#else
+#define LOP_BIGENDIAN 0
+#endif
+#elif defined(__BIG_ENDIAN__) || defined(__lm32__) || defined(__ARMEB__) || \
+      defined(__MIPSEB__) || defined(__sparc__) || defined(__powerpc__)
+#define LOP_BIGENDIAN 1
+#elif defined(__LITTLE_ENDIAN__) || defined(__i386__) || \
+      defined(__x86_64__) || defined(__ARMEL__) || defined(__MIPSEL__)
+#define LOP_BIGENDIAN 0
+#else
+#error "lop: unable to determine the target byte order"
+#endif
 
-/* These macros come from the Linux kernel */
+/* Byte swapping. GCC and clang lower the builtins to single bswap/rev
+ * instructions, or movbe when the swap is fused with a load or store. */
 
-#ifndef lop_swap16
-#define lop_swap16(x) \
-({ \
-    uint16_t __x = (x); \
-    ((uint16_t)( \
-	(((uint16_t)(__x) & (uint16_t)0x00ffU) << 8) | \
-	(((uint16_t)(__x) & (uint16_t)0xff00U) >> 8) )); \
-})
-#warning USING UNOPTIMISED ENDIAN STUFF
-#endif
+#if defined(__clang__) || (defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 8)))
 
-#ifndef lop_swap32
-#define lop_swap32(x) \
-({ \
-    uint32_t __x = (x); \
-    ((uint32_t)( \
-	(((uint32_t)(__x) & (uint32_t)0x000000ffUL) << 24) | \
-	(((uint32_t)(__x) & (uint32_t)0x0000ff00UL) <<  8) | \
-	(((uint32_t)(__x) & (uint32_t)0x00ff0000UL) >>  8) | \
-	(((uint32_t)(__x) & (uint32_t)0xff000000UL) >> 24) )); \
-})
-#endif
+#define lop_swap16(x) __builtin_bswap16(x)
+#define lop_swap32(x) __builtin_bswap32(x)
+#define lop_swap64(x) __builtin_bswap64(x)
 
-#if 0
-#ifndef lop_swap64
-#define lop_swap64(x) \
-({ \
-    uint64_t __x = (x); \
-    ((uint64_t)( \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x00000000000000ffULL) << 56) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x000000000000ff00ULL) << 40) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x0000000000ff0000ULL) << 24) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x00000000ff000000ULL) <<  8) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x000000ff00000000ULL) >>  8) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x0000ff0000000000ULL) >> 24) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0x00ff000000000000ULL) >> 40) | \
-	(uint64_t)(((uint64_t)(__x) & (uint64_t)0xff00000000000000ULL) >> 56) )); \
-})
-#endif
 #else
 
-typedef union {
-    uint64_t all;
-    struct {
-	uint32_t a;
-	uint32_t b;
-    } part;
-} lop_split64;
-
-static inline uint64_t lop_swap64(uint64_t x)
+static inline uint16_t lop_swap16(uint16_t x)
 {
-    lop_split64 in, out;
+    return (uint16_t)((x << 8) | (x >> 8));
+}
 
-    in.all = x;
-    out.part.a = lop_swap32(in.part.b);
-    out.part.b = lop_swap32(in.part.a);
+static inline uint32_t lop_swap32(uint32_t x)
+{
+    return ((x & 0x000000ffUL) << 24) |
+           ((x & 0x0000ff00UL) <<  8) |
+           ((x & 0x00ff0000UL) >>  8) |
+           ((x & 0xff000000UL) >> 24);
+}
 
-    return out.all;
+static inline uint64_t lop_swap64(uint64_t x)
+{
+    return ((uint64_t)lop_swap32((uint32_t)x) << 32) |
+           lop_swap32((uint32_t)(x >> 32));
 }
+
 #endif
 
 /* Host to OSC and OSC to Host conversion macros */
 
-#if 1
+#if LOP_BIGENDIAN
 #define lop_htoo16(x) (x)
 #define lop_htoo32(x) (x)
 #define lop_htoo64(x) (x)
@@ -30,9 +30,11 @@ extern "C" {
 
 #include <stdarg.h>
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include "lop/lop_types.h"
 #include "lop/lop_errors.h"
+#include "lop/lop_timetag.h"
 
 /**
  * \defgroup loplowlevel Low-level OSC API
@@ -248,6 +250,37 @@ int lop_message_get_argc(lop_message m);
  */
 lop_arg **lop_message_get_argv(lop_message m);
 
+/**
+ * \brief  Copy the numeric arguments of a message into an array of floats.
+ *
+ * Arguments first to first + count - 1 are looked at, or first to the last
+ * one if count is negative. Each int32, int64, float or double among them
+ * is converted and stored in turn in out, which must have room for one
+ * value per argument looked at; other arguments are skipped. Runs of
+ * arguments of the same type are converted with one array loop, without
+ * building argv.
+ *
+ * Returns the number of values stored, or -1 if first is not an argument
+ * index of the message.
+ */
+int lop_message_get_floats(lop_message m, int first, int count, float *out);
+
+/**
+ * \brief  Copy the numeric arguments of a message into an array of
+ * doubles, see lop_message_get_floats().
+ */
+int lop_message_get_doubles(lop_message m, int first, int count,
+    double *out);
+
+/**
+ * \brief  Copy the numeric arguments of a message into an array of 32 bit
+ * integers, see lop_message_get_floats(). Floating point values are
+ * truncated towards zero, NaN becomes 0 and values out of range
+ * INT32_MIN or INT32_MAX, as in lop_coerce().
+ */
+int lop_message_get_int32s(lop_message m, int first, int count,
+    int32_t *out);
+
 /**
  * \brief  Return the length of a message in bytes.
  *
@@ -273,6 +306,46 @@ size_t lop_message_length(lop_message m, const char *path);
 void *lop_message_serialise(lop_message m, const char *path, void *to,
     size_t *size);
 
+/**
+ * \brief  Serialise a message into a buffer the caller owns, without
+ * allocating.
+ *
+ * \param m The message to be serialised
+ * \param path The path the message will be sent to
+ * \param to The buffer to serialise to
+ * \param size The size of the buffer
+ *
+ * Returns the size of the serialised message. If it is larger than size
+ * nothing is written, so a caller with a buffer too small, or none, can
+ * grow it to the size returned and call again. Lengths are worked out
+ * once and the path, typetag and arguments are written in one pass,
+ * converted to network byte order on the way.
+ */
+size_t lop_message_serialise_into(lop_message m, const char *path, void *to,
+    size_t size);
+
+/**
+ * \brief  Serialise a message as a list of pieces for writev() or
+ * sendmsg(), without copying its larger strings and blobs.
+ *
+ * \param m The message to be serialised
+ * \param path The path the message will be sent to
+ * \param iov Filled in with the pieces of the message, in order
+ * \param iovcnt The number of entries iov has room for
+ * \param scratch Room for the path, typetag, and arguments that have to
+ * be converted to network byte order or are too small to be worth a piece
+ * of their own
+ * \param scratch_size The size of scratch; lop_message_length() bytes is
+ * always enough
+ *
+ * Strings, symbols and blob contents of 128 bytes or more are sent from
+ * where they lie in the message, which must not change or be freed until
+ * the pieces have been sent. Returns the number of entries of iov filled,
+ * or -1 if iov or scratch is too small.
+ */
+int lop_message_serialise_iov(lop_message m, const char *path,
+    struct iovec *iov, int iovcnt, void *scratch, size_t scratch_size);
+
 /**
  * \brief  Deserialise a raw OSC message and return a new lop_message object.
  * Opposite of lop_message_serialise().
@@ -288,6 +361,28 @@ void *lop_message_serialise(lop_message m, const char *path, void *to,
  */
 lop_message lop_message_deserialise(void *data, size_t size, int *result);
 
+/**
+ * \brief  Validate a raw OSC message in place and describe it with a view.
+ *
+ * Unlike lop_message_deserialise() nothing is copied or allocated: the
+ * arguments are converted to host byte order inside data, and the path,
+ * types and argument pointers of the view all point into data.
+ *
+ * \param v The view to fill in, typically on the caller's stack.
+ * \param data Pointer to the raw OSC message data in network transmission
+ * form. It is modified in place and must stay valid while the view is used.
+ * \param size The size of data in bytes
+ * \param argv An array that receives a pointer to each argument.
+ * \param maxargs The number of entries in argv.
+ *
+ * Returns 0 on success or an LOP_E* error code. If the message has more
+ * than maxargs arguments LOP_TOOBIG is returned with v->argc set and data
+ * left untouched, so the call can be retried with a larger array. After
+ * any other failure the contents of data are undefined.
+ */
+int lop_message_view_init(lop_message_view *v, void *data, size_t size,
+    lop_arg **argv, int maxargs);
+
 /**
  * \brief  Dispatch a raw block of memory containing an OSC message.
  *
@@ -298,13 +393,135 @@ lop_message lop_message_deserialise(void *data, size_t size, int *result);
  *
  * \param s The lop_server to use for dispatching.
  * \param data Pointer to the raw OSC message data in network transmission form
- * (network byte order where appropriate).
+ * (network byte order where appropriate). Messages are validated and
+ * converted to host byte order in place, so the buffer must be writable and
+ * its contents are not preserved.
  * \param size The size of data in bytes
  *
  * Returns the number of bytes used if successful, or less than 0 otherwise.
  */
 int lop_server_dispatch_data(lop_server s, void *data, size_t size);
 
+/**
+ * \brief Dispatch a batch of raw OSC packets, eg. as received by one
+ * call to recvmmsg().
+ *
+ * Each packet is handled as by lop_server_dispatch_data(), but the
+ * server's clock is read once for the whole batch, scheduled events are
+ * flushed once before it, and the dispatch scratch memory is reused
+ * across it and released at the end.
+ *
+ * \param s The lop_server to use for dispatching.
+ * \param packets The packets; like lop_server_dispatch_data(), each is
+ * converted in place.
+ * \param count The number of packets.
+ * \param status If not NULL, status[i] is set to what
+ * lop_server_dispatch_data() would have returned for packet i.
+ *
+ * \return The number of packets dispatched without error.
+ */
+int lop_server_dispatch_batch(lop_server s, const struct iovec *packets,
+    int count, int *status);
+
+/**
+ * \brief Create a decoder for a stream of OSC packets, such as a TCP
+ * connection.
+ *
+ * \param s The server the packets are dispatched through.
+ * \param framing How the packets are delimited, LOP_STREAM_LENGTH or
+ * LOP_STREAM_SLIP.
+ * \param max_packet The largest packet accepted, in bytes; larger ones
+ * are dropped with a LOP_TOOBIG error. 0 selects 64 kB. The decoder
+ * never holds more than this.
+ */
+lop_stream lop_stream_new(lop_server s, lop_stream_framing framing,
+    size_t max_packet);
+
+/** \brief Free a stream decoder and any partial packet it holds. */
+void lop_stream_free(lop_stream st);
+
+/**
+ * \brief Pass the next bytes of a stream to a decoder.
+ *
+ * \param st The decoder.
+ * \param data The bytes, of any length; chunks need not line up with
+ * packets. Every packet that is complete within data is dispatched from
+ * where it lies, decoded and converted in place, so like
+ * lop_server_dispatch_data() the buffer must be writable and its contents
+ * are not preserved. Only packets split across calls are copied. Packets
+ * are dispatched in place only from 4 byte aligned addresses.
+ * \param size The number of bytes.
+ *
+ * Invalid packets are reported through the server's error handler.
+ *
+ * \return The number of packets completed by these bytes.
+ */
+int lop_stream_feed(lop_stream st, void *data, size_t size);
+
+/**
+ * \brief Drop any partial packet, eg. when the connection is reopened.
+ */
+void lop_stream_reset(lop_stream st);
+
+/**
+ * \brief Start building a bundle.
+ *
+ * \param tt The bundle's timetag, eg. LOP_TT_IMMEDIATE.
+ * \param size The bytes to allocate for the packet up front; it grows as
+ * needed. 0 selects 256.
+ *
+ * Messages are serialised straight into the bundle's buffer as they are
+ * added, and each element's size is filled in once it is known, so the
+ * finished bundle is one contiguous packet ready to send. Returns NULL if
+ * out of memory.
+ */
+lop_bundle lop_bundle_new(lop_timetag tt, size_t size);
+
+/** \brief Free a bundle and its packet. */
+void lop_bundle_free(lop_bundle b);
+
+/**
+ * \brief Empty a bundle, keeping its buffer, to build another one with
+ * the given timetag.
+ */
+void lop_bundle_reset(lop_bundle b, lop_timetag tt);
+
+/**
+ * \brief Add a message to a bundle, or to the innermost nested bundle
+ * that is open.
+ *
+ * Returns 0 on success, or -1 if out of memory, in which case the bundle
+ * is left as it was.
+ */
+int lop_bundle_add_message(lop_bundle b, const char *path, lop_message m);
+
+/**
+ * \brief Start a bundle nested in the current one. Elements added until
+ * the matching lop_bundle_close() go into it.
+ *
+ * Returns 0 on success, or -1 if out of memory.
+ */
+int lop_bundle_open(lop_bundle b, lop_timetag tt);
+
+/**
+ * \brief End the innermost open nested bundle.
+ *
+ * Returns 0 on success, or -1 if no nested bundle is open.
+ */
+int lop_bundle_close(lop_bundle b);
+
+/**
+ * \brief Return the finished bundle packet, closing any nested bundles
+ * still open.
+ *
+ * \param b The bundle.
+ * \param size If non-NULL, the size of the packet is written here.
+ *
+ * The packet belongs to the bundle; it is valid until the bundle is
+ * changed, reset or freed.
+ */
+void *lop_bundle_data(lop_bundle b, size_t *size);
+
 /**
  * \brief Return true if the type specified has a numerical value, such as
  * LOP_INT32, LOP_FLOAT etc.
@@ -330,6 +547,11 @@ int lop_is_string_type(lop_type a);
  * the path, but not the exact types, and is coercible (ie. all numerical
  * types in numerical positions).
  *
+ * Floating point values are truncated towards zero when converted to an
+ * integer type. NaN becomes 0 and values outside the integer's range its
+ * minimum or maximum. An int64 converted to an int32 keeps its low 32
+ * bits.
+ *
  * On failure no translation occurs and false is returned.
  *
  * \param type_to   The type of the destination variable.
@@ -364,6 +586,146 @@ lop_server lop_server_new(lop_err_handler err_h, lop_send_handler send_h, void *
  */
 void lop_server_free(lop_server s);
 
+/**
+ * \brief Serve the server's dispatch-time allocations from an arena.
+ *
+ * By default the coercion buffers, argument arrays and namespace reply
+ * lists built while dispatching go through malloc() and free(). Once the
+ * arena is enabled they are bump-allocated from memory owned by the server
+ * and released all at once, in O(1), when lop_server_dispatch_data()
+ * returns. Scheduled bundle elements are kept in a separate pool whose
+ * blocks are recycled rather than freed.
+ *
+ * Call this before any bundles have been scheduled.
+ *
+ * \param s The server.
+ * \param size The initial arena size in bytes, or 0 for a default. The
+ * arena grows by itself if a single dispatch needs more.
+ *
+ * Returns 0 on success, or -1 if memory could not be allocated or events
+ * are already scheduled.
+ */
+int lop_server_enable_arena(lop_server s, size_t size);
+
+/**
+ * \brief Return the number of times dispatch found an incoming address
+ * pattern in the server's cache of compiled patterns, and the number of
+ * times it had to compile one.
+ *
+ * Either pointer may be NULL.
+ */
+void lop_server_pattern_cache_stats(lop_server s, unsigned long *hits,
+    unsigned long *misses);
+
+/**
+ * \brief Have a server send the messages it generates, such as replies to
+ * method enumeration, in pieces through send_iov rather than through the
+ * send handler it was created with.
+ *
+ * The pieces come from lop_message_serialise_iov(), so larger string and
+ * blob arguments are not copied on the way out. NULL goes back to the
+ * plain send handler.
+ */
+void lop_server_set_send_iov(lop_server s, lop_send_iov_handler send_iov,
+    void *arg);
+
+/**
+ * \brief Set the clock a server schedules bundles by.
+ *
+ * \param s The server.
+ * \param clock Called with arg whenever the server needs the current
+ * time, eg. lop_clock_monotonic. NULL selects lop_timetag_now(), the
+ * default.
+ * \param arg Passed to clock.
+ *
+ * The clock is read at most once per call to lop_server_dispatch_data(),
+ * however many bundles and scheduled events that call handles.
+ */
+void lop_server_set_clock(lop_server s, lop_clock_handler clock, void *arg);
+
+/**
+ * \brief Read a server's clock once and hold that time.
+ *
+ * Until lop_server_unlatch_time() is called, the server treats the held
+ * time as the current time. Call this once per batch of received packets
+ * to read the clock once per batch instead of once per packet. Calling
+ * it again refreshes the held time.
+ */
+void lop_server_latch_time(lop_server s);
+
+/** \brief Go back to reading the clock at each dispatch.
+ *
+ * This also leaves virtual time, see lop_server_set_virtual_time(). */
+void lop_server_unlatch_time(lop_server s);
+
+/**
+ * \brief Run a server on virtual time, starting at t.
+ *
+ * From now on the server's clock is not read: the current time is t
+ * until the application moves it on with lop_server_advance_time().
+ * Bundles are scheduled, and lop_server_next_event_delay() counts, by
+ * that time, so a recorded session can be replayed as fast as it can be
+ * dispatched, in the same order every time. lop_server_unlatch_time()
+ * or lop_server_set_clock() go back to the clock.
+ */
+void lop_server_set_virtual_time(lop_server s, lop_timetag t);
+
+/**
+ * \brief Move a server's virtual time forward to t.
+ *
+ * Every scheduled event due by t is dispatched, in timetag order, with
+ * the current time set to the event's own timetag, so events the
+ * handlers schedule on the way are dispatched in order too. Time never
+ * goes backwards; a t before the current time dispatches nothing.
+ * Starts virtual time at t if the server was not already on it.
+ *
+ * \return The number of events dispatched.
+ */
+int lop_server_advance_time(lop_server s, lop_timetag t);
+
+/**
+ * \brief Sleep until the next scheduled event is due and dispatch it.
+ *
+ * \param s The server.
+ * \param timeout_ms The longest time to wait, in milliseconds. If it is
+ * negative the wait is only limited by the next event, and the call
+ * returns straight away if none is scheduled.
+ *
+ * The sleep is to an absolute deadline on the monotonic clock, so it does
+ * not drift with the time spent getting there, and the last part of it
+ * is spent busy-polling the server's clock (see lop_server_set_wait_spin())
+ * until the event is due by it, so the event is dispatched as close to its
+ * timetag as possible. Every event due by then is dispatched. The timeout
+ * is measured on the monotonic clock. On virtual time the time is
+ * advanced instead, without sleeping. A time held by
+ * lop_server_latch_time() is released.
+ *
+ * \return The number of events dispatched, 0 if the timeout came first.
+ */
+int lop_server_wait_until_next(lop_server s, int timeout_ms);
+
+/**
+ * \brief Set how long lop_server_wait_until_next() busy-polls before a
+ * deadline, in microseconds.
+ *
+ * Sleeping can overshoot by the operating system's wakeup latency, so the
+ * wait wakes this much early and polls the clock for the rest. 0 turns
+ * polling off. The default is 100, which covers the 50us timer slack
+ * Linux gives ordinary threads.
+ */
+void lop_server_set_wait_spin(lop_server s, unsigned int spin_us);
+
+/**
+ * \brief Return the number of messages whose destination methods and
+ * coercions were found in the server's dispatch cache, and the number
+ * that had to be resolved.
+ *
+ * The cache is keyed by path and typetag, and is emptied whenever a
+ * method is added or deleted. Either pointer may be NULL.
+ */
+void lop_server_dispatch_cache_stats(lop_server s, unsigned long *hits,
+    unsigned long *misses);
+
 /**
  * \brief Add an OSC method to the specifed server.
  *
@@ -387,7 +749,9 @@ lop_method lop_server_add_method(lop_server s, const char *path,
  *
  * \param s The server the method is to be removed from.
  * \param path The OSC path of the method to delete. If NULL is passed the
- * method will match the generic handler.
+ * method will match the generic handler. An OSC address pattern deletes
+ * every method it would dispatch to; as in dispatch, wildcards only match
+ * within one '/'-separated part of the path.
  * \param typespec The typespec the method accepts.
  */
 void lop_server_del_method(lop_server s, const char *path,
@@ -431,10 +795,35 @@ uint32_t lop_blobsize(lop_blob b);
  */
 int lop_pattern_match(const char *str, const char *p);
 
+/**
+ * \brief Compile an OSC address pattern for repeated matching.
+ *
+ * Each '/'-separated part of the pattern is compiled to an automaton that
+ * matches in time linear in the length of the string tested, however
+ * the wildcards are arranged. Unlike lop_pattern_match(), wildcards only
+ * match within a single part of the address.
+ *
+ * Returns the compiled pattern, or NULL if it is malformed (eg. has an
+ * unterminated [set] or {list}) or memory could not be allocated.
+ */
+lop_pattern lop_pattern_compile(const char *pattern);
+
+/**
+ * \brief Test an OSC path against a compiled pattern.
+ *
+ * Returns 1 if the path matches, otherwise 0. A compiled pattern must not
+ * be used by two threads at once.
+ */
+int lop_pattern_exec(lop_pattern p, const char *path);
+
+/** \brief Free a pattern returned by lop_pattern_compile(). */
+void lop_pattern_free(lop_pattern p);
+
 
 /** \brief Find the time difference between two timetags
  *
- * Returns a - b in seconds.
+ * Returns a - b in seconds. See lop_timetag.h for exact integer
+ * arithmetic on timetags.
  */
 double lop_timetag_diff(lop_timetag a, lop_timetag b);
 
@@ -445,6 +834,16 @@ double lop_timetag_diff(lop_timetag a, lop_timetag b);
  */
 void lop_timetag_now(lop_timetag *t);
 
+/** \brief Return the current time from a monotonic clock
+ *
+ * The clock is anchored to the wall clock the first time any thread reads
+ * it, once for the whole process, so it gives NTP timetags like
+ * lop_timetag_now(), but it never steps when the system time is changed.
+ * It may be read from several threads at once. It can be given to lop_server_set_clock(),
+ * which ignores arg.
+ */
+void lop_clock_monotonic(lop_timetag *t, void *arg);
+
 /**
  * \brief Return the storage size, in bytes, of the given argument.
  */
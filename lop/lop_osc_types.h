@@ -22,6 +22,7 @@
  * constants.
  */
 
+#include <stddef.h>
 #include <stdint.h>
 
 /**
@@ -118,6 +119,29 @@ typedef union {
     lop_timetag t;
 } lop_arg;
 
+/**
+ * \brief A borrowed view of a raw OSC message.
+ *
+ * Filled in by lop_message_view_init(), which validates the message and
+ * converts its arguments to host byte order in place. Every pointer refers
+ * into the caller's packet buffer, which must outlive the view. Nothing is
+ * allocated, so views are meant to live on the stack.
+ */
+typedef struct {
+	/** The message path. */
+	const char *path;
+	/** The type tag string, including the leading ','. */
+	char *types;
+	/** The number of arguments. */
+	int argc;
+	/** The argument data, in host byte order. */
+	void *data;
+	/** The size of the argument data in bytes. */
+	size_t datalen;
+	/** The caller's argument array, argv[n] points at argument n. */
+	lop_arg **argv;
+} lop_message_view;
+
 /** \brief A timetag constant representing "now". */
 /* Note: No struct literals in MSVC */
 #define LOP_TT_IMMEDIATE ((lop_timetag){0U,1U})
@@ -0,0 +1,113 @@
+/*
+ *  This program is free software; you can redistribute it and/or
+ *  modify it under the terms of the GNU Lesser General Public License
+ *  as published by the Free Software Foundation; either version 2.1
+ *  of the License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+#ifndef LOP_TIMETAG_H
+#define LOP_TIMETAG_H
+
+#include <stdint.h>
+
+#include "lop/lop_osc_types.h"
+
+/**
+ * \file lop_timetag.h Integer timetag arithmetic.
+ *
+ * A timetag is handled here as a single 64 bit fixed point number of
+ * 2^-32 second units, seconds in the high word, and time differences as
+ * signed numbers of the same units. Differences wrap with the NTP era,
+ * so timetags up to 68 years apart compare correctly across a rollover.
+ * None of this uses floating point.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** \brief Return a timetag as a 32.32 fixed point number of seconds. */
+static inline uint64_t lop_timetag_to_fixed(lop_timetag t)
+{
+    return ((uint64_t)t.sec << 32) | t.frac;
+}
+
+/** \brief Return the timetag of a 32.32 fixed point number of seconds. */
+static inline lop_timetag lop_timetag_from_fixed(uint64_t f)
+{
+    lop_timetag t;
+
+    t.sec = (uint32_t)(f >> 32);
+    t.frac = (uint32_t)f;
+    return t;
+}
+
+/** \brief Return a - b in 2^-32 second units. */
+static inline int64_t lop_timetag_sub(lop_timetag a, lop_timetag b)
+{
+    return (int64_t)(lop_timetag_to_fixed(a) - lop_timetag_to_fixed(b));
+}
+
+/** \brief Return t moved by delta 2^-32 second units. */
+static inline lop_timetag lop_timetag_add(lop_timetag t, int64_t delta)
+{
+    return lop_timetag_from_fixed(lop_timetag_to_fixed(t) + (uint64_t)delta);
+}
+
+/** \brief Return a negative number, zero or a positive number as a is
+ * before, the same as or after b. */
+static inline int lop_timetag_cmp(lop_timetag a, lop_timetag b)
+{
+    int64_t d = lop_timetag_sub(a, b);
+
+    return (d > 0) - (d < 0);
+}
+
+/** \brief Convert 2^-32 second units to nanoseconds, rounding to the
+ * nearest. */
+static inline int64_t lop_timetag_units_to_ns(int64_t units)
+{
+    uint64_t u = units < 0 ? -(uint64_t)units : (uint64_t)units;
+    uint64_t ns = (u >> 32) * 1000000000u +
+		  (((u & 0xffffffffu) * 1000000000u + 0x80000000u) >> 32);
+
+    return units < 0 ? -(int64_t)ns : (int64_t)ns;
+}
+
+/** \brief Convert nanoseconds to 2^-32 second units, rounding to the
+ * nearest. */
+static inline int64_t lop_timetag_ns_to_units(int64_t ns)
+{
+    uint64_t n = ns < 0 ? -(uint64_t)ns : (uint64_t)ns;
+    uint64_t units = ((n / 1000000000u) << 32) +
+		     (((n % 1000000000u) << 32) + 500000000u) / 1000000000u;
+
+    return ns < 0 ? -(int64_t)units : (int64_t)units;
+}
+
+/** \brief Return a - b in nanoseconds. */
+static inline int64_t lop_timetag_diff_ns(lop_timetag a, lop_timetag b)
+{
+    return lop_timetag_units_to_ns(lop_timetag_sub(a, b));
+}
+
+/** \brief Return t moved by ns nanoseconds. */
+static inline lop_timetag lop_timetag_add_ns(lop_timetag t, int64_t ns)
+{
+    return lop_timetag_add(t, lop_timetag_ns_to_units(ns));
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+/* vi:set ts=8 sts=4 sw=4: */
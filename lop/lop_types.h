@@ -25,6 +25,8 @@
 extern "C" {
 #endif
 
+#include <sys/uio.h>
+
 #include "lop/lop_osc_types.h"
 
 /**
@@ -50,6 +52,13 @@ typedef void *lop_message;
  */
 typedef void *lop_method;
 
+/**
+ * \brief A compiled OSC address pattern.
+ *
+ * Created by calls to lop_pattern_compile().
+ */
+typedef void *lop_pattern;
+
 /**
  * \brief An object representing an instance of an OSC server.
  *
@@ -58,6 +67,33 @@ typedef void *lop_method;
  */
 typedef void *lop_server;
 
+/**
+ * \brief A decoder that frames OSC packets out of a byte stream and
+ * dispatches them through a server.
+ *
+ * Created by calls to lop_stream_new().
+ */
+typedef void *lop_stream;
+
+/**
+ * \brief A bundle being built, element by element, into one packet.
+ *
+ * Created by calls to lop_bundle_new().
+ */
+typedef void *lop_bundle;
+
+/**
+ * \brief The ways OSC packets can be framed in a byte stream.
+ */
+typedef enum {
+    /** Each packet preceded by its size as a 32 bit big-endian integer,
+     * as OSC 1.0 specifies for TCP. */
+    LOP_STREAM_LENGTH,
+    /** Each packet SLIP encoded (RFC 1055) and ended by an END byte, as
+     * OSC 1.1 specifies. */
+    LOP_STREAM_SLIP
+} lop_stream_framing;
+
 /**
  * \brief A callback function to receive notifcation of an error in a server or
  * server thread.
@@ -73,6 +109,28 @@ typedef void (*lop_err_handler)(int num, const char *msg, const char *where);
 
 typedef void (*lop_send_handler)(const char *msg, size_t len, void *arg);
 
+/**
+ * \brief A callback function that sends a message as scattered pieces,
+ * eg. with writev() or sendmsg().
+ *
+ * \param iov The pieces of the serialised message, in order.
+ * \param iovcnt The number of pieces.
+ * \param len The total size of the message.
+ * \param arg The argument given to lop_server_set_send_iov().
+ *
+ * The pieces are only valid during the call.
+ */
+typedef void (*lop_send_iov_handler)(const struct iovec *iov, int iovcnt,
+    size_t len, void *arg);
+
+/**
+ * \brief A callback function that tells a server the current time.
+ *
+ * \param t Filled in with the current time as an OSC timetag.
+ * \param arg The argument given to lop_server_set_clock().
+ */
+typedef void (*lop_clock_handler)(lop_timetag *t, void *arg);
+
 /**
  * \brief A callback function to receive notifcation of matching message
  * arriving in the server.
@@ -3,6 +3,50 @@
 
 #include <lop/lop_osc_types.h>
 
+#include "lop_types_internal.h"
+#include "lop/lop_endian.h"
+
+/* The properties of an OSC type, see lop_type_table */
+typedef struct {
+    /* size of a fixed size argument; 0 for no data or a variable size */
+    uint8_t size;
+    /* width of the words converted to or from network byte order: a
+     * timetag is two 4 byte words and a blob starts with one; 0 for
+     * none */
+    uint8_t swap;
+    /* LOP_TYPE_* */
+    uint8_t flags;
+    /* 1 + the type's index in coercion tables if it is numeric, else 0 */
+    uint8_t numeric;
+} lop_type_desc;
+
+#define LOP_TYPE_VALID   0x01
+/* padded string data, validated with lop_validate_string() */
+#define LOP_TYPE_STRING  0x02
+/* size prefixed data, validated with lop_validate_blob() */
+#define LOP_TYPE_BLOB    0x04
+#define LOP_TYPE_NUMERIC 0x08
+
+/* Descriptors of every type by typetag character; unknown types are
+ * all zero */
+extern const lop_type_desc lop_type_table[256];
+
+#define lop_type_desc_of(type) (&lop_type_table[(unsigned char)(type)])
+
+/* Convert an argument described by t between host and network byte
+ * order, the same operation either way */
+static inline void lop_type_swap(const lop_type_desc *t, void *data)
+{
+    if (t->swap == 8) {
+	*(uint64_t *)data = lop_otoh64(*(uint64_t *)data);
+    } else if (t->swap == 4) {
+	((uint32_t *)data)[0] = lop_otoh32(((uint32_t *)data)[0]);
+	if (t->size == 8) {
+	    ((uint32_t *)data)[1] = lop_otoh32(((uint32_t *)data)[1]);
+	}
+    }
+}
+
 /**
  * \brief Validate raw OSC string data. Where applicable, data should be
  * in network byte order.
@@ -56,4 +100,192 @@ ssize_t lop_validate_bundle(void *data, ssize_t size);
  */
 ssize_t lop_validate_arg(lop_type type, void *data, ssize_t size);
 
+/**
+ * \brief Set up a bump arena with an initial chunk of size bytes.
+ *
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+int lop_arena_init(lop_arena *a, size_t size);
+
+/**
+ * \brief Allocate size bytes from an arena. The memory stays valid until
+ * the next lop_arena_reset(); if the current chunk is full a larger one is
+ * chained on.
+ */
+void *lop_arena_alloc(lop_arena *a, size_t size);
+
+/**
+ * \brief Release everything allocated from an arena in O(1), keeping only
+ * the most recent (largest) chunk.
+ */
+void lop_arena_reset(lop_arena *a);
+
+/** \brief Free all memory owned by an arena. */
+void lop_arena_free(lop_arena *a);
+
+/**
+ * \brief Allocate size bytes from a pool, reusing a released block of the
+ * same size class where possible.
+ */
+void *lop_pool_alloc(lop_pool *p, size_t size);
+
+/** \brief Return a block obtained from lop_pool_alloc() to its pool. */
+void lop_pool_release(lop_pool *p, void *ptr);
+
+/** \brief Free the blocks cached by a pool. */
+void lop_pool_free(lop_pool *p);
+
+/**
+ * \brief Schedule item for time, after any item already scheduled for the
+ * same time. Returns 0 on success or -1 if out of memory.
+ */
+int lop_sched_push(lop_sched *q, uint64_t time, void *item);
+
+/**
+ * \brief Return the earliest scheduled item, storing its time in *time if
+ * time is not NULL, or NULL if nothing is scheduled.
+ */
+void *lop_sched_peek(lop_sched *q, uint64_t *time);
+
+/** \brief Remove and return the earliest scheduled item, or NULL. */
+void *lop_sched_pop(lop_sched *q);
+
+/** \brief Free a schedule. The items are not freed. */
+void lop_sched_free(lop_sched *q);
+
+/** \brief Hash an OSC path for the method index. */
+uint32_t lop_method_hash(const char *path);
+
+/**
+ * \brief Add a method to the server's path index, after any method
+ * registered before it. Returns 0 on success or -1 if out of memory.
+ */
+int lop_method_index_add(struct _lop_server *s, struct _lop_method *m);
+
+/** \brief Remove a method from the server's path index. */
+void lop_method_index_remove(struct _lop_server *s, struct _lop_method *m);
+
+/**
+ * \brief Return the first method registered at exactly path, whose hash
+ * is given, or NULL. Use lop_method_index_next() to find later ones.
+ */
+struct _lop_method *lop_method_index_find(struct _lop_server *s,
+    const char *path, uint32_t hash);
+
+/** \brief Return the next method registered at the same path as m. */
+struct _lop_method *lop_method_index_next(struct _lop_method *m,
+    const char *path, uint32_t hash);
+
+/** \brief Free the server's path index. */
+void lop_method_index_free(struct _lop_server *s);
+
+/**
+ * \brief Add a method with a path to the server's address trie.
+ * Returns 0 on success or -1 if out of memory.
+ */
+int lop_method_trie_add(struct _lop_server *s, struct _lop_method *m);
+
+/**
+ * \brief Remove a method from the server's address trie, pruning nodes
+ * that are no longer used.
+ */
+void lop_method_trie_remove(struct _lop_server *s, struct _lop_method *m);
+
+/**
+ * \brief Call found(m, arg) for every method whose path matches a
+ * compiled OSC address pattern, in no particular order.
+ *
+ * The pattern is matched one '/'-separated part at a time, so wildcards
+ * never match across a '/', and only the branches of the trie whose part
+ * matches are descended.
+ */
+void lop_method_trie_match(struct _lop_server *s, struct _lop_pattern *p,
+    void (*found)(struct _lop_method *m, void *arg), void *arg);
+
+/** \brief Free the server's address trie. */
+void lop_method_trie_free(struct _lop_server *s);
+
+/**
+ * \brief Test len bytes of str, which hold no '/', against part n of a
+ * compiled pattern. Uses the pattern's scratch space, so a pattern must
+ * not be matched from two threads at once.
+ */
+int lop_pattern_match_part(struct _lop_pattern *p, int n, const char *str,
+    size_t len);
+
+/**
+ * \brief Set up an LRU cache holding up to capacity values, keyed by
+ * strings of bytes. free_value, if not NULL, is called on values as they
+ * are evicted. A capacity of 0 disables the cache.
+ *
+ * Returns 0 on success or -1 if memory could not be allocated.
+ */
+int lop_cache_init(lop_cache *c, unsigned int capacity,
+    void (*free_value)(void *value));
+
+/**
+ * \brief Return the value cached under key, marking it most recently
+ * used, or NULL. Counts a hit or a miss.
+ */
+void *lop_cache_get(lop_cache *c, const char *key, size_t len);
+
+/**
+ * \brief Cache value under key, which must not be cached already,
+ * evicting the least recently used value if the cache is full.
+ *
+ * Returns 0 on success, or -1 if the value could not be cached, in which
+ * case it still belongs to the caller.
+ */
+int lop_cache_put(lop_cache *c, const char *key, size_t len, void *value);
+
+/** \brief Evict everything from a cache. */
+void lop_cache_clear(lop_cache *c);
+
+/** \brief Free a cache and everything in it. */
+void lop_cache_free(lop_cache *c);
+
+/**
+ * \brief Return the plan for passing arguments of the given types to a
+ * method, building and caching it on the method the first time those
+ * types are seen. Returns NULL if out of memory.
+ */
+lop_coerce_plan *lop_coerce_plan_get(struct _lop_method *m,
+    const char *types);
+
+/**
+ * \brief Return the function converting one numeric argument of type from
+ * to type to, or NULL unless both are numeric and differ.
+ */
+lop_convert_fn lop_coerce_converter(lop_type from, lop_type to);
+
+/**
+ * \brief Carry out the steps of a plan: fill out[] with argv[], converting
+ * arguments where the steps say into data, which holds the plan's nslots
+ * 8 byte slots.
+ */
+void lop_coerce_run(const lop_coerce_step *steps, int nsteps,
+    lop_arg **argv, int argc, lop_arg **out, void *data);
+
+/** \brief Free the plans cached on a method. */
+void lop_coerce_plans_free(struct _lop_method *m);
+
+/**
+ * \brief lop_message_view_init(), for a packet whose path has already
+ * been validated.
+ *
+ * path_size is the padded size of the path that lop_validate_string()
+ * returned, or 0 to validate it here.
+ */
+int lop_message_view_parse(lop_message_view *v, void *data, size_t size,
+    ssize_t path_size, lop_arg **argv, int maxargs);
+
+/**
+ * \brief Point a message structure at the packet described by a view.
+ *
+ * The resulting message borrows the view's types, data and argv, so it can
+ * be handed to method handlers without copying. It must not be extended
+ * and lop_message_free() ignores it.
+ */
+void lop_message_from_view(struct _lop_message *m, lop_message_view *v);
+
 #endif
@@ -2,11 +2,20 @@
 #define LOP_TYPES_H
 
 #include <sys/types.h>
+#include <sys/uio.h>
 
 #include "lop/lop_osc_types.h"
 
 typedef void (*lop_err_handler)(int num, const char *msg, const char *where);
 typedef void (*lop_send_handler)(const char *msg, size_t len, void *arg);
+typedef void (*lop_send_iov_handler)(const struct iovec *iov, int iovcnt,
+    size_t len, void *arg);
+typedef void (*lop_clock_handler)(lop_timetag *t, void *arg);
+
+typedef enum {
+    LOP_STREAM_LENGTH,
+    LOP_STREAM_SLIP
+} lop_stream_framing;
 
 struct _lop_method;
 
@@ -25,6 +34,9 @@ typedef struct _lop_message {
         lop_arg   **argv;
         /* timestamp from bundle (LOP_TT_IMMEDIATE for unbundled messages) */
         lop_timetag ts;
+        /* types, data and argv point into a caller's packet, see
+         * lop_message_from_view() */
+        int borrowed;
 } *lop_message;
 
 typedef int (*lop_method_handler)(const char *path, const char *types,
@@ -37,16 +49,233 @@ typedef struct _lop_method {
 	lop_method_handler  handler;
 	char              *user_data;
 	struct _lop_method *next;
+	/* next method in the same hash bucket, or next generic method */
+	struct _lop_method *hash_next;
+	uint32_t           hash;
+	/* registration order */
+	unsigned long      seq;
+	/* address trie node of the path, and next method at that node */
+	struct _lop_trie_node *node;
+	struct _lop_method *node_next;
+	/* coercions from the typetags seen so far, most recent first */
+	struct _lop_coerce_plan *plans;
+	/* deleted while a dispatch may still hold it */
+	int                dead;
 } *lop_method;
 
+typedef void (*lop_convert_fn)(lop_arg *to, const lop_arg *from);
+
+/* Convert n arguments from[] into consecutive slots to[], pointing out[]
+ * at them */
+typedef void (*lop_convert_run_fn)(lop_arg *to, lop_arg **from,
+    lop_arg **out, int n);
+
+/* Convert count arguments from arg on into the 8 byte slots from dst on
+ * of the output buffer */
+typedef struct {
+	int arg;
+	int dst;
+	int count;
+	lop_convert_run_fn convert;
+} lop_coerce_step;
+
+/* How to present arguments of the given types to a method */
+typedef struct _lop_coerce_plan {
+	struct _lop_coerce_plan *next;
+	/* incoming typetag, without the ',' */
+	char *types;
+	/* 0 if the types cannot be coerced to the method's */
+	int ok;
+	/* arguments not listed are passed through as they are */
+	int nsteps;
+	/* converted arguments, the 8 byte slots the steps need */
+	int nslots;
+	lop_coerce_step *steps;
+} lop_coerce_plan;
+
+/* One '/'-separated part of the registered address space */
+typedef struct _lop_trie_node {
+	char *name;
+	struct _lop_trie_node *parent;
+	/* sorted by name */
+	struct _lop_trie_node **children;
+	int nchildren;
+	int children_size;
+	/* methods registered at the path ending here */
+	struct _lop_method *methods;
+} lop_trie_node;
+
+/* One state of a compiled pattern part, see pattern.c */
+typedef struct {
+	unsigned char op;
+	unsigned char c;
+	unsigned short nalts;
+	/* set, alternatives or jump target, by op */
+	int arg;
+	/* states reachable without reading a character, in parts of up
+	 * to 64 states */
+	uint64_t eps;
+} lop_pattern_state;
+
+/* How a pattern part is matched */
+enum {
+	LOP_PART_LITERAL,	/* the text itself */
+	LOP_PART_PREFIX,	/* the prefix followed by a single '*' */
+	LOP_PART_ALTS,		/* one {list}, with no other wildcards */
+	LOP_PART_AUTOMATON
+};
+
+typedef struct {
+	/* source text of the part */
+	const char *text;
+	/* length of the text before the first wildcard */
+	size_t prefix;
+	int kind;
+	/* states, or none if the part is a plain string */
+	int start;
+	int nstates;
+} lop_pattern_part;
+
+/* An OSC address pattern compiled to one automaton per address part */
+typedef struct _lop_pattern {
+	int nparts;
+	lop_pattern_part *parts;
+	lop_pattern_state *states;
+	int *alts;
+	uint8_t (*sets)[32];
+	/* current and next state sets of a running match */
+	uint32_t *scratch;
+	int nwords;
+} *lop_pattern;
+
+struct _lop_cache_entry;
+
+/* string keyed LRU cache */
+typedef struct {
+	struct _lop_cache_entry **table;
+	unsigned int table_size;
+	unsigned int count;
+	unsigned int capacity;
+	/* most and least recently used */
+	struct _lop_cache_entry *head;
+	struct _lop_cache_entry *tail;
+	void (*free_value)(void *value);
+	unsigned long hits;
+	unsigned long misses;
+} lop_cache;
+
+struct _lop_arena_chunk;
+
+/* bump allocator, chunk is NULL while disabled */
+typedef struct {
+	struct _lop_arena_chunk *chunk;
+	size_t used;
+} lop_arena;
+
+/* power of two size classes from 64 bytes to 64k */
+#define LOP_POOL_CLASSES 11
+
+/* free-list allocator, plain malloc/free while disabled */
+typedef struct {
+	int enabled;
+	void *free[LOP_POOL_CLASSES];
+} lop_pool;
+
+typedef struct {
+	/* OSC timetag as one integer: seconds in the high word */
+	uint64_t time;
+	/* ties are broken by scheduling order */
+	uint64_t seq;
+	void *item;
+} lop_sched_entry;
+
+/* binary min-heap of scheduled items */
+typedef struct {
+	lop_sched_entry *heap;
+	unsigned int count;
+	unsigned int size;
+	uint64_t seq;
+} lop_sched;
+
 typedef struct _lop_server {
 	lop_method first;
+	/* methods with a path, hashed on it; table_size is a power of two */
+	lop_method *table;
+	unsigned int table_size;
+	unsigned int table_count;
+	/* methods registered with a NULL path, in registration order */
+	lop_method catchall;
+	/* methods with a path, by address part, for pattern dispatch */
+	lop_trie_node *trie;
+	/* compiled incoming address patterns */
+	lop_cache patterns;
+	/* dispatch plans by path and typetag, bypassed while stale */
+	lop_cache resolved;
+	int resolved_stale;
+	/* cached plans handlers are running from, not to be evicted */
+	int resolved_busy;
+	/* methods deleted during dispatch, freed when it returns */
+	lop_method dead;
+	unsigned long method_seq;
 	lop_err_handler err_h;
-	void *queued;
+	/* bundle elements waiting for their timetag */
+	lop_sched queued;
 	lop_send_handler send_h;
 	void *send_h_arg;
+	/* used instead of send_h if set */
+	lop_send_iov_handler send_iov_h;
+	void *send_iov_h_arg;
+	/* messages are serialised here for send_h, grown as needed */
+	char *send_buf;
+	size_t send_buf_size;
+	/* transient allocations of one lop_server_dispatch_data() call */
+	lop_arena arena;
+	/* scheduled bundle elements */
+	lop_pool sched_pool;
+	int dispatch_depth;
+	/* time source, lop_timetag_now() if NULL */
+	lop_clock_handler clock;
+	void *clock_arg;
+	/* the time read once per dispatch, or held by lop_server_latch_time() */
+	lop_timetag now;
+	int now_valid;
+	int now_latched;
+	/* now is set by the application, the clock is not read */
+	int now_virtual;
+	/* microseconds to busy-poll before a scheduled event */
+	unsigned int wait_spin;
 } *lop_server;
 
+typedef struct _lop_stream {
+	lop_server server;
+	lop_stream_framing framing;
+	size_t max_packet;
+	/* the part of a packet received so far, when it spans feeds */
+	char *buf;
+	size_t buf_size;
+	size_t len;
+	/* LOP_STREAM_LENGTH: size prefix bytes read, and the packet size */
+	unsigned char prefix[4];
+	int prefix_len;
+	size_t need;
+	/* bytes left of an oversized packet being dropped; for SLIP, drop
+	 * until the next END */
+	size_t discard;
+	/* SLIP: the last byte was ESC */
+	int escape;
+} *lop_stream;
+
+typedef struct _lop_bundle {
+	/* the packet so far, len bytes of size */
+	char *data;
+	size_t size;
+	size_t len;
+	/* offsets of the size words of the nested bundles still open */
+	size_t *open;
+	int depth;
+	int open_size;
+} *lop_bundle;
+
 typedef struct _lop_strlist {
 	char *str;
 	struct _lop_strlist *next;
@@ -21,6 +21,16 @@
 #include <inttypes.h>
 #include <math.h>
 
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include "lop_types_internal.h"
 #include "lop_internal.h"
 #include "lop/lop_lowlevel.h"
@@ -31,18 +41,31 @@
 #define LOP_DEF_TYPE_SIZE 8
 #define LOP_DEF_DATA_SIZE 8
 
-static char lop_numerical_types[] = {
-    LOP_INT32,
-    LOP_FLOAT,
-    LOP_INT64,
-    LOP_DOUBLE,
-    '\0'
-};
-
-static char lop_string_types[] = {
-    LOP_STRING,
-    LOP_SYMBOL,
-    '\0'
+/* Argument bytes lop_message_serialise_iov() sends from where they lie
+ * rather than copying; smaller pieces are cheaper to copy than to send
+ * as iovecs of their own */
+#define LOP_IOV_REF_MIN 128
+
+#define FIXED(size, swap)	{ size, swap, LOP_TYPE_VALID, 0 }
+#define NUMERIC(size, index)	{ size, size, LOP_TYPE_VALID | LOP_TYPE_NUMERIC, \
+				  1 + index }
+
+const lop_type_desc lop_type_table[256] = {
+    /* numeric indices as in the coercion tables of coerce.c */
+    [LOP_INT32]     = NUMERIC(4, 0),
+    [LOP_INT64]     = NUMERIC(8, 1),
+    [LOP_FLOAT]     = NUMERIC(4, 2),
+    [LOP_DOUBLE]    = NUMERIC(8, 3),
+    [LOP_CHAR]      = FIXED(4, 4),
+    [LOP_MIDI]      = FIXED(4, 0),
+    [LOP_TIMETAG]   = FIXED(8, 4),
+    [LOP_STRING]    = { 0, 0, LOP_TYPE_VALID | LOP_TYPE_STRING, 0 },
+    [LOP_SYMBOL]    = { 0, 0, LOP_TYPE_VALID | LOP_TYPE_STRING, 0 },
+    [LOP_BLOB]      = { 0, 4, LOP_TYPE_VALID | LOP_TYPE_BLOB, 0 },
+    [LOP_TRUE]      = FIXED(0, 0),
+    [LOP_FALSE]     = FIXED(0, 0),
+    [LOP_NIL]       = FIXED(0, 0),
+    [LOP_INFINITUM] = FIXED(0, 0),
 };
 
 static int lop_message_add_typechar(lop_message m, char t);
@@ -77,12 +100,16 @@ lop_message lop_message_new(void)
     m->datasize = 0;
     m->argv = NULL;
     m->ts = LOP_TT_IMMEDIATE;
+    m->borrowed = 0;
 
     return m;
 }
 
 void lop_message_free(lop_message m)
 {
+    if (m && m->borrowed) {
+        return;
+    }
     if (m) {
 	free(m->types);
 	free(m->data);
@@ -379,7 +406,7 @@ int lop_message_add_midi(lop_message m, uint8_t a[4])
     if (lop_message_add_typechar(m, LOP_MIDI))
         return -1;
 
-    memcpy(nptr, a, sizeof(a));
+    memcpy(nptr, a, 4);
     return 0;
 }
 
@@ -405,6 +432,7 @@ int lop_message_add_infinitum(lop_message m)
 
 static int lop_message_add_typechar(lop_message m, char t)
 {
+    if (m->borrowed) return -1;
     if (m->typelen + 1 >= m->typesize) {
         int new_typesize = m->typesize * 2;
         char *new_types = 0;
@@ -432,6 +460,8 @@ static void *lop_message_add_data(lop_message m, size_t s)
     int new_datalen = m->datalen + s;
     void *new_data = 0;
 
+	if (m->borrowed)
+	    return 0;
 	if (!new_datasize)
 	    new_datasize = LOP_DEF_DATA_SIZE;
 
@@ -452,43 +482,31 @@ static void *lop_message_add_data(lop_message m, size_t s)
     return (void*)((char*)m->data + old_dlen);
 }
 
+/* Bytes a string of len characters takes up with its terminator and
+ * padding */
+#define padded_size(len) (4 * ((len) / 4 + 1))
+
 int lop_strsize(const char *s)
 {
-    return 4 * (strlen(s) / 4 + 1);
+    return padded_size(strlen(s));
 }
 
 size_t lop_arg_size(lop_type type, void *data)
 {
-    switch (type) {
-    case LOP_TRUE:
-    case LOP_FALSE:
-    case LOP_NIL:
-    case LOP_INFINITUM:
-	return 0;
-
-    case LOP_INT32:
-    case LOP_FLOAT:
-    case LOP_MIDI:
-    case LOP_CHAR:
-	return 4;
+    const lop_type_desc *t = lop_type_desc_of(type);
 
-    case LOP_INT64:
-    case LOP_TIMETAG:
-    case LOP_DOUBLE:
-	return 8;
-
-    case LOP_STRING:
-    case LOP_SYMBOL:
+    if (t->size) {
+	return t->size;
+    }
+    if (t->flags & LOP_TYPE_STRING) {
 	return lop_strsize((char *)data);
-
-    case LOP_BLOB:
+    }
+    if (t->flags & LOP_TYPE_BLOB) {
 	return lop_blobsize((lop_blob)data);
-
-    default:
+    }
+    if (!t->flags) {
 	fprintf(stderr, "lop warning: unhandled OSC type '%c' at %s:%d\n", type, __FILE__, __LINE__);
-	return 0;
     }
-
     return 0;
 }
 
@@ -498,27 +516,179 @@ char *lop_get_path(void *data, ssize_t size)
     return (result >= 4) ? (char *)data : NULL;
 }
 
-ssize_t lop_validate_string(void *data, ssize_t size)
+/* Words with a 1 in the low bit, and the high bit, of each byte */
+#define WORD_ONES (~0UL / 255)
+#define WORD_HIGHS (WORD_ONES * 0x80)
+
+/*
+ * Return the offset of the first NUL in the size bytes at p, or -1 if
+ * there is none. Vector units scan 32 or 16 bytes at a time where the
+ * build targets them, then whole words, then single bytes; nothing past
+ * p + size is read.
+ */
+static ssize_t find_nul(const char *p, ssize_t size)
+{
+    ssize_t i = 0;
+
+#if defined(__AVX2__)
+    for (; i + 32 <= size; i += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+	unsigned int mask = _mm256_movemask_epi8(
+	    _mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+
+	if (mask) {
+	    return i + __builtin_ctz(mask);
+	}
+    }
+#endif
+#if defined(__SSE2__)
+    for (; i + 16 <= size; i += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+	unsigned int mask = _mm_movemask_epi8(
+	    _mm_cmpeq_epi8(v, _mm_setzero_si128()));
+
+	if (mask) {
+	    return i + __builtin_ctz(mask);
+	}
+    }
+#elif defined(__ARM_NEON)
+    for (; i + 16 <= size; i += 16) {
+	uint8x16_t eq = vceqq_u8(vld1q_u8((const uint8_t *)p + i),
+				 vdupq_n_u8(0));
+	/* narrow to four bits per byte */
+	uint64_t mask = vget_lane_u64(vreinterpret_u64_u8(
+	    vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+
+	if (mask) {
+	    return i + (__builtin_ctzll(mask) >> 2);
+	}
+    }
+#endif
+
+    /* whole aligned words, then the bytes left */
+    for (; i < size && ((uintptr_t)(p + i) & (sizeof(unsigned long) - 1));
+	 i++) {
+	if (!p[i]) {
+	    return i;
+	}
+    }
+    for (; i + (ssize_t)sizeof(unsigned long) <= size;
+	 i += sizeof(unsigned long)) {
+	unsigned long w = *(const unsigned long *)(p + i);
+
+	if ((w - WORD_ONES) & ~w & WORD_HIGHS) {
+	    break;
+	}
+    }
+    for (; i < size; i++) {
+	if (!p[i]) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+#if !LOP_BIGENDIAN
+/*
+ * Copy size bytes, a multiple of width, byte swapping each 4 or 8 byte
+ * word on the way; to may equal from. Goes a vector at a time where the
+ * build targets a vector unit.
+ * Without SSSE3's byte shuffle, SSE2 swaps the bytes of each 16 bit lane
+ * and then reverses the lanes of each word.
+ */
+static void swap_copy(void *to, const void *from, size_t size, int width)
+{
+    const char *p = from, *end = p + size;
+    char *q = to;
+
+#if defined(__AVX2__)
+    const __m256i rev32 = _mm256_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10,
+	9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14,
+	13, 12);
+    const __m256i rev64 = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14,
+	13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10,
+	9, 8);
+    const __m256i rev = width == 8 ? rev64 : rev32;
+
+    for (; end - p >= 32; p += 32, q += 32) {
+	__m256i v = _mm256_loadu_si256((const __m256i *)p);
+
+	_mm256_storeu_si256((__m256i *)q, _mm256_shuffle_epi8(v, rev));
+    }
+#endif
+#if defined(__SSSE3__)
+    {
+	const __m128i rev = width == 8 ?
+	    _mm_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 15, 14, 13, 12, 11, 10, 9, 8) :
+	    _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+
+	for (; end - p >= 16; p += 16, q += 16) {
+	    __m128i v = _mm_loadu_si128((const __m128i *)p);
+
+	    _mm_storeu_si128((__m128i *)q, _mm_shuffle_epi8(v, rev));
+	}
+    }
+#elif defined(__SSE2__)
+    for (; end - p >= 16; p += 16, q += 16) {
+	__m128i v = _mm_loadu_si128((const __m128i *)p);
+
+	v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+	if (width == 8) {
+	    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+	    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0, 1, 2, 3));
+	} else {
+	    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+	}
+	_mm_storeu_si128((__m128i *)q, v);
+    }
+#elif defined(__ARM_NEON)
+    for (; end - p >= 16; p += 16, q += 16) {
+	uint8x16_t v = vld1q_u8((const uint8_t *)p);
+
+	vst1q_u8((uint8_t *)q, width == 8 ? vrev64q_u8(v) : vrev32q_u8(v));
+    }
+#endif
+
+    if (width == 8) {
+	for (; p < end; p += 8, q += 8) {
+	    *(uint64_t *)q = lop_swap64(*(const uint64_t *)p);
+	}
+    } else {
+	for (; p < end; p += 4, q += 4) {
+	    *(uint32_t *)q = lop_swap32(*(const uint32_t *)p);
+	}
+    }
+}
+#else
+/* Network byte order is host byte order */
+static void swap_copy(void *to, const void *from, size_t size, int width)
+{
+    if (to != from) {
+	memcpy(to, from, size);
+    }
+}
+#endif
+
+/* lop_validate_string(), also returning the length of the string in *n */
+static ssize_t validate_string_len(void *data, ssize_t size, ssize_t *n)
 {
-    ssize_t i = 0, len = 0;
+    ssize_t i, len;
     char *pos = data;
 
     if (size < 0) {
         return -LOP_ESIZE;      // invalid size
     }
-    for (i = 0; i < size; ++i) {
-        if (pos[i] == '\0') {
-            len = 4 * (i / 4 + 1);
-            break;
-        }
-    }
-    if (0 == len) {
+    i = find_nul(pos, size);
+    if (i < 0) {
         return -LOP_ETERM;      // string not terminated
     }
+    *n = i;
+    len = 4 * (i / 4 + 1);
     if (len > size) {
         return -LOP_ESIZE;      // would overflow buffer
     }
-    for (; i < len; ++i) {
+    for (++i; i < len; ++i) {
         if (pos[i] != '\0') {
             return -LOP_EPAD;  // non-zero char found in pad area
         }
@@ -526,6 +696,13 @@ ssize_t lop_validate_string(void *data, ssize_t size)
     return len;
 }
 
+ssize_t lop_validate_string(void *data, ssize_t size)
+{
+    ssize_t n;
+
+    return validate_string_len(data, size, &n);
+}
+
 
 ssize_t lop_validate_blob(void *data, ssize_t size)
 {
@@ -596,106 +773,48 @@ ssize_t lop_validate_bundle(void *data, ssize_t size)
 
 ssize_t lop_validate_arg(lop_type type, void *data, ssize_t size)
 {
+    const lop_type_desc *t = lop_type_desc_of(type);
+
     if (size < 0) {
         return -1;
     }
-    switch (type) {
-    case LOP_TRUE:
-    case LOP_FALSE:
-    case LOP_NIL:
-    case LOP_INFINITUM:
-        return 0;
-
-    case LOP_INT32:
-    case LOP_FLOAT:
-    case LOP_MIDI:
-    case LOP_CHAR:
-        return size >= 4 ? 4 : -LOP_ESIZE;
-
-    case LOP_INT64:
-    case LOP_TIMETAG:
-    case LOP_DOUBLE:
-        return size >= 8 ? 8 : -LOP_ESIZE;
-
-    case LOP_STRING:
-    case LOP_SYMBOL:
+    if (t->size) {
+        return size >= t->size ? t->size : -LOP_ESIZE;
+    }
+    if (t->flags & LOP_TYPE_STRING) {
         return lop_validate_string((char *)data, size);
-
-    case LOP_BLOB:
-        return lop_validate_blob((lop_blob)data, size);
-
-    default:
-        return -LOP_EINVALIDTYPE;
     }
-    return -LOP_INT_ERR;
+    if (t->flags & LOP_TYPE_BLOB) {
+        return size >= 4 ? lop_validate_blob((lop_blob)data, size)
+                         : -LOP_ESIZE;
+    }
+    return t->flags ? 0 : -LOP_EINVALIDTYPE;
 }
 
 /* convert endianness of arg pointed to by data from network to host */
 void lop_arg_host_endian(lop_type type, void *data)
 {
-    switch (type) {
-    case LOP_INT32:
-    case LOP_FLOAT:
-    case LOP_BLOB:
-    case LOP_CHAR:
-	*(int32_t *)data = lop_otoh32(*(int32_t *)data);
-	break;
-
-    case LOP_INT64:
-    case LOP_TIMETAG:
-    case LOP_DOUBLE:
-	*(int64_t *)data = lop_otoh64(*(int64_t *)data);
-	break;
-
-    case LOP_STRING:
-    case LOP_SYMBOL:
-    case LOP_MIDI:
-    case LOP_TRUE:
-    case LOP_FALSE:
-    case LOP_NIL:
-    case LOP_INFINITUM:
-	/* these are fine */
-	break;
+    const lop_type_desc *t = lop_type_desc_of(type);
 
-    default:
+    if (!t->flags) {
 	fprintf(stderr, "lop warning: unhandled OSC type '%c' at %s:%d\n",
 		type, __FILE__, __LINE__);
-	break;
+	return;
     }
+    lop_type_swap(t, data);
 }
 
 /* convert endianness of arg pointed to by data from host to network */
 void lop_arg_network_endian(lop_type type, void *data)
 {
-    switch (type) {
-    case LOP_INT32:
-    case LOP_FLOAT:
-    case LOP_BLOB:
-    case LOP_CHAR:
-        *(int32_t *)data = lop_htoo32(*(int32_t *)data);
-        break;
-
-    case LOP_INT64:
-    case LOP_TIMETAG:
-    case LOP_DOUBLE:
-        *(int64_t *)data = lop_htoo64(*(int64_t *)data);
-        break;
+    const lop_type_desc *t = lop_type_desc_of(type);
 
-    case LOP_STRING:
-    case LOP_SYMBOL:
-    case LOP_MIDI:
-    case LOP_TRUE:
-    case LOP_FALSE:
-    case LOP_NIL:
-    case LOP_INFINITUM:
-        /* these are fine */
-        break;
-
-    default:
+    if (!t->flags) {
         fprintf(stderr, "lop warning: unhandled OSC type '%c' at %s:%d\n",
                 type, __FILE__, __LINE__);
-        break;
+        return;
     }
+    lop_type_swap(t, data);
 }
 
 lop_timetag lop_message_get_timestamp(lop_message m)
@@ -705,7 +824,7 @@ lop_timetag lop_message_get_timestamp(lop_message m)
 
 size_t lop_message_length(lop_message m, const char *path)
 {
-    return lop_strsize(path) + lop_strsize(m->types) + m->datalen;
+    return lop_strsize(path) + padded_size(m->typelen) + m->datalen;
 }
 
 int lop_message_get_argc(lop_message m)
@@ -741,45 +860,281 @@ char *lop_message_get_types(lop_message m)
     return m->types + 1;
 }
 
+/* Write s and its zero padding to to, which has room for size bytes */
+static char *put_padded(char *to, const char *s, size_t len, size_t size)
+{
+    /* the last word holds the terminator and any padding */
+    memset(to + size - 4, 0, 4);
+    memcpy(to, s, len);
+    return to + size;
+}
+
+/* Write the message to to in network byte order, in one pass */
+static void message_encode(lop_message m, const char *path, size_t path_len,
+    size_t path_size, char *to)
+{
+    const char *types = m->types + 1;
+    const char *data = m->data;
+    int i, argc = m->typelen - 1;
+
+    to = put_padded(to, path, path_len, path_size);
+    to = put_padded(to, m->types, m->typelen, padded_size(m->typelen));
+
+    for (i = 0; i < argc; ) {
+        const lop_type_desc *t = lop_type_desc_of(types[i]);
+        size_t len;
+
+        if (t->size && t->swap) {
+            /* swap runs of words of one width together, as
+             * lop_message_parse_args() does */
+            int width = t->swap;
+
+            len = 0;
+            do {
+                len += t->size;
+                t = lop_type_desc_of(types[++i]);
+            } while (i < argc && t->size && t->swap == width);
+            swap_copy(to, data, len, width);
+        } else {
+            len = lop_arg_size(types[i], (void *)data);
+            memcpy(to, data, len);
+            lop_arg_network_endian(types[i], to);
+            i++;
+        }
+        to += len;
+        data += len;
+    }
+}
+
 void *lop_message_serialise(lop_message m, const char *path, void *to,
 			   size_t *size)
 {
-    int i, argc;
-    char *types, *ptr;
-    size_t s = lop_message_length(m, path);
+    size_t path_len = strlen(path), path_size = padded_size(path_len);
+    size_t s = path_size + padded_size(m->typelen) + m->datalen;
 
     if (size) {
 	*size = s;
     }
 
     if (!to) {
-	to = calloc(1, s);
+	to = malloc(s);
+	if (!to) {
+	    return NULL;
+	}
     }
-    memset((char*)to + lop_strsize(path) - 4, 0, 4); // ensure zero-padding
-    strcpy(to, path);
-    memset((char*)to + lop_strsize(path) + lop_strsize(m->types) - 4, 0, 4);
-    strcpy((char*)to + lop_strsize(path), m->types);
+    message_encode(m, path, path_len, path_size, to);
+    return to;
+}
 
-    types = m->types + 1;
-    ptr = (char*)to + lop_strsize(path) + lop_strsize(m->types);
-    memcpy(ptr, m->data, m->datalen);
+size_t lop_message_serialise_into(lop_message m, const char *path, void *to,
+    size_t size)
+{
+    size_t path_len = strlen(path), path_size = padded_size(path_len);
+    size_t s = path_size + padded_size(m->typelen) + m->datalen;
 
-    i = 0;
-    argc = m->typelen - 1;
-    for (i = 0; i < argc; ++i) {
-        size_t len = lop_arg_size(types[i], ptr);
-        lop_arg_network_endian(types[i], ptr);
-        ptr += len;
+    if (s <= size) {
+	message_encode(m, path, path_len, path_size, to);
     }
-    return to;
+    return s;
+}
+
+/* State of lop_message_serialise_iov(): the iovecs filled so far, and the
+ * piece of scratch not yet covered by one */
+typedef struct {
+    struct iovec *iov;
+    int count;
+    int max;
+    char *seg;
+    char *pos;
+    char *end;
+} iov_writer;
+
+/* End the scratch piece in progress, then add data as a piece of its own */
+static int iov_ref(iov_writer *w, const void *data, size_t len)
+{
+    if (w->pos > w->seg) {
+	if (w->count == w->max) {
+	    return -1;
+	}
+	w->iov[w->count].iov_base = w->seg;
+	w->iov[w->count].iov_len = w->pos - w->seg;
+	w->count++;
+	w->seg = w->pos;
+    }
+    if (data) {
+	if (w->count == w->max) {
+	    return -1;
+	}
+	w->iov[w->count].iov_base = (void *)data;
+	w->iov[w->count].iov_len = len;
+	w->count++;
+    }
+    return 0;
+}
+
+/* Send len bytes of data as they are: in place if large, else copied */
+static int iov_put(iov_writer *w, const char *data, size_t len)
+{
+    if (len >= LOP_IOV_REF_MIN) {
+	return iov_ref(w, data, len);
+    }
+    if ((size_t)(w->end - w->pos) < len) {
+	return -1;
+    }
+    memcpy(w->pos, data, len);
+    w->pos += len;
+    return 0;
+}
+
+int lop_message_serialise_iov(lop_message m, const char *path,
+    struct iovec *iov, int iovcnt, void *scratch, size_t scratch_size)
+{
+    size_t path_len = strlen(path), path_size = padded_size(path_len);
+    size_t types_size = padded_size(m->typelen);
+    const char *types = m->types + 1;
+    const char *data = m->data;
+    int i, argc = m->typelen - 1;
+    iov_writer w;
+
+    if (scratch_size < path_size + types_size) {
+	return -1;
+    }
+    w.iov = iov;
+    w.count = 0;
+    w.max = iovcnt;
+    w.seg = scratch;
+    w.pos = put_padded(scratch, path, path_len, path_size);
+    w.pos = put_padded(w.pos, m->types, m->typelen, types_size);
+    w.end = (char *)scratch + scratch_size;
+
+    for (i = 0; i < argc; ) {
+	const lop_type_desc *t = lop_type_desc_of(types[i]);
+	size_t len;
+
+	if (t->size && t->swap) {
+	    /* numbers are converted into scratch, as for
+	     * lop_message_serialise() */
+	    int width = t->swap;
+
+	    len = 0;
+	    do {
+		len += t->size;
+		t = lop_type_desc_of(types[++i]);
+	    } while (i < argc && t->size && t->swap == width);
+	    if ((size_t)(w.end - w.pos) < len) {
+		return -1;
+	    }
+	    swap_copy(w.pos, data, len, width);
+	    w.pos += len;
+	} else {
+	    len = lop_arg_size(types[i], (void *)data);
+	    if (t->flags & LOP_TYPE_BLOB) {
+		/* the size is converted, the contents sent as they are */
+		if (w.end - w.pos < 4) {
+		    return -1;
+		}
+		swap_copy(w.pos, data, 4, 4);
+		w.pos += 4;
+		if (iov_put(&w, data + 4, len - 4)) {
+		    return -1;
+		}
+	    } else if (t->swap) {
+		if ((size_t)(w.end - w.pos) < len) {
+		    return -1;
+		}
+		memcpy(w.pos, data, len);
+		lop_arg_network_endian(types[i], w.pos);
+		w.pos += len;
+	    } else if (iov_put(&w, data, len)) {
+		return -1;
+	    }
+	    i++;
+	}
+	data += len;
+    }
+    if (iov_ref(&w, NULL, 0)) {
+	return -1;
+    }
+    return w.count;
 }
 
 
+/*
+ * Validate argc arguments of the given types starting at ptr, convert
+ * them to host byte order in place and point argv at each of them, all
+ * in one pass: each argument is bounds checked, swapped and indexed
+ * as its type descriptor says. Returns 0 or an LOP_E* error code.
+ */
+static int lop_message_parse_args(const char *types, int argc, char *ptr,
+    ssize_t remain, lop_arg **argv)
+{
+    char *end = ptr + remain;
+    ssize_t len;
+    int i;
+
+    for (i = 0; i < argc; ++i) {
+        const lop_type_desc *t = lop_type_desc_of(types[i]);
+
+        if (t->size && t->swap) {
+            /* a run of fixed size arguments made of words of one width,
+             * swapped together */
+            char *start = ptr;
+            int width = t->swap;
+
+            for (;;) {
+                if (end - ptr < t->size) {
+                    return LOP_EINVALIDARG;
+                }
+                argv[i] = (lop_arg *)ptr;
+                ptr += t->size;
+                if (i + 1 == argc) {
+                    break;
+                }
+                t = lop_type_desc_of(types[i + 1]);
+                if (!t->size || t->swap != width) {
+                    break;
+                }
+                i++;
+            }
+            swap_copy(start, start, ptr - start, width);
+        } else if (t->size) {
+            if (end - ptr < t->size) {
+                return LOP_EINVALIDARG;
+            }
+            argv[i] = (lop_arg *)ptr;
+            ptr += t->size;
+        } else if (t->flags & LOP_TYPE_STRING) {
+            len = lop_validate_string(ptr, end - ptr);
+            if (len < 0) {
+                return LOP_EINVALIDARG;
+            }
+            argv[i] = (lop_arg *)ptr;
+            ptr += len;
+        } else if (t->flags & LOP_TYPE_BLOB) {
+            if (end - ptr < 4 || (len = lop_validate_blob(ptr, end - ptr)) < 0) {
+                return LOP_EINVALIDARG;
+            }
+            lop_type_swap(t, ptr);
+            argv[i] = (lop_arg *)ptr;
+            ptr += len;
+        } else if (t->flags) {
+            argv[i] = NULL;
+        } else {
+            return LOP_EINVALIDARG;
+        }
+    }
+    if (ptr != end) {
+        return LOP_ESIZE; // size/argument mismatch
+    }
+    return 0;
+}
+
 lop_message lop_message_deserialise(void *data, size_t size, int *result)
 {
     lop_message msg = NULL;
     char *types = NULL, *ptr = NULL;
-    int i = 0, argc = 0, remain = size, res = 0, len;
+    int argc = 0, remain = size, res = 0, len;
+    ssize_t typelen;
 
     if (remain <= 0) { res = LOP_ESIZE; goto fail; }
 
@@ -794,6 +1149,7 @@ lop_message lop_message_deserialise(void *data, size_t size, int *result)
     msg->datasize = 0;
     msg->argv = NULL;
     msg->ts = LOP_TT_IMMEDIATE;
+    msg->borrowed = 0;
 
     // path
     len = lop_validate_string(data, remain);
@@ -809,7 +1165,7 @@ lop_message lop_message_deserialise(void *data, size_t size, int *result)
         goto fail;
     }
     types = (char*)data + len;
-    len = lop_validate_string(types, remain);
+    len = validate_string_len(types, remain, &typelen);
     if (len < 0) {
         res = LOP_EINVALIDTYPE; // invalid type tag string
         goto fail;
@@ -820,7 +1176,7 @@ lop_message lop_message_deserialise(void *data, size_t size, int *result)
     }
     remain -= len;
 
-    msg->typelen = strlen(types);
+    msg->typelen = typelen;
     msg->typesize = len;
     msg->types = malloc(msg->typesize);
     if (NULL == msg->types) { res = LOP_EALLOC; goto fail; }
@@ -840,19 +1196,8 @@ lop_message lop_message_deserialise(void *data, size_t size, int *result)
         if (NULL == msg->argv) { res = LOP_EALLOC; goto fail; }
     }
 
-    for (i = 0; remain >= 0 && i < argc; ++i) {
-        len = lop_validate_arg((lop_type)types[i], ptr, remain);
-        if (len < 0) {
-            res = LOP_EINVALIDARG; // invalid argument
-            goto fail;
-        }
-        lop_arg_host_endian((lop_type)types[i], ptr);
-        msg->argv[i] = len ? (lop_arg*)ptr : NULL;
-        remain -= len;
-        ptr += len;
-    }
-    if (0 != remain || i != argc) {
-        res = LOP_ESIZE; // size/argument mismatch
+    res = lop_message_parse_args(types, argc, ptr, remain, msg->argv);
+    if (res) {
         goto fail;
     }
 
@@ -865,6 +1210,72 @@ fail:
     return NULL;
 }
 
+int lop_message_view_init(lop_message_view *v, void *data, size_t size,
+    lop_arg **argv, int maxargs)
+{
+    return lop_message_view_parse(v, data, size, 0, argv, maxargs);
+}
+
+int lop_message_view_parse(lop_message_view *v, void *data, size_t size,
+    ssize_t path_size, lop_arg **argv, int maxargs)
+{
+    char *types;
+    ssize_t remain = size, len = path_size, typelen;
+
+    if (remain <= 0) {
+        return LOP_ESIZE;
+    }
+
+    // path
+    if (!len) {
+        len = lop_validate_string(data, remain);
+        if (len < 0) {
+            return LOP_EINVALIDPATH;
+        }
+    }
+    remain -= len;
+
+    // types
+    if (remain <= 0) {
+        return LOP_ENOTYPE;
+    }
+    types = (char *)data + len;
+    len = validate_string_len(types, remain, &typelen);
+    if (len < 0) {
+        return LOP_EINVALIDTYPE;
+    }
+    if (types[0] != ',') {
+        return LOP_EBADTYPE;
+    }
+    remain -= len;
+
+    v->path = data;
+    v->types = types;
+    v->argc = typelen - 1;
+    v->data = types + len;
+    v->datalen = remain;
+    v->argv = argv;
+    if (v->argc > maxargs) {
+        return LOP_TOOBIG;
+    }
+
+    // args
+    return lop_message_parse_args(types + 1, v->argc, v->data, remain, argv);
+}
+
+void lop_message_from_view(lop_message m, lop_message_view *v)
+{
+    m->types = v->types;
+    m->typelen = v->argc + 1;
+    m->typesize = 0;
+    m->data = v->data;
+    m->datalen = v->datalen;
+    m->datasize = 0;
+    m->argv = v->argv;
+    m->ts = LOP_TT_IMMEDIATE;
+    m->borrowed = 1;
+}
+
 void lop_message_pp(lop_message m)
 {
     void *d = m->data;
@@ -877,7 +1288,8 @@ void lop_message_pp(lop_message m)
 	    printf(" ");
 	}
 
-	lop_arg_pp_internal(m->types[i], d, 1);
+	/* message data is kept in host byte order */
+	lop_arg_pp_internal(m->types[i], d, 0);
 	d = (char*)d + lop_arg_size(m->types[i], d);
     }
     putchar('\n');
@@ -994,16 +1406,18 @@ void lop_arg_pp_internal(lop_type type, void *data, int bigendian)
 
 int lop_is_numerical_type(lop_type a)
 {
-    return strchr(lop_numerical_types, a) != 0;
+    return (lop_type_desc_of(a)->flags & LOP_TYPE_NUMERIC) != 0;
 }
 
 int lop_is_string_type(lop_type a)
 {
-    return strchr(lop_string_types, a) != 0;
+    return (lop_type_desc_of(a)->flags & LOP_TYPE_STRING) != 0;
 }
 
 int lop_coerce(lop_type type_to, lop_arg *to, lop_type type_from, lop_arg *from)
 {
+    lop_convert_fn convert;
+
     if (type_to == type_from) {
 	memcpy(to, from, lop_arg_size(type_from, from));
 
@@ -1016,29 +1430,10 @@ int lop_coerce(lop_type type_to, lop_arg *to, lop_type type_from, lop_arg *from)
 	return 1;
     }
 
-    if (lop_is_numerical_type(type_to) && lop_is_numerical_type(type_from)) {
-	switch (type_to) {
-	case LOP_INT32:
-	    to->i = (uint32_t)lop_hires_val(type_from, from);
-	    break;
-
-	case LOP_INT64:
-	    to->i64 = (uint64_t)lop_hires_val(type_from, from);
-	    break;
-
-	case LOP_FLOAT:
-	    to->f = (float)lop_hires_val(type_from, from);
-	    break;
-
-	case LOP_DOUBLE:
-	    to->d = (double)lop_hires_val(type_from, from);
-	    break;
+    convert = lop_coerce_converter(type_from, type_to);
+    if (convert) {
+	convert(to, from);
 
-	default:
-	    fprintf(stderr, "lop: bad coercion: %c -> %c\n", type_from,
-		    type_to);
-	    return 0;
-	}
 	return 1;
     }
 
@@ -15,10 +15,17 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "lop_types_internal.h"
+#include "lop_internal.h"
 #include "lop/lop_lowlevel.h"
 
+/* Initial number of hash buckets, grown by doubling to keep the load
+ * factor at or below one */
+#define LOP_DEF_TABLE_SIZE 16
+
 void lop_method_pp(lop_method m)
 {
     lop_method_pp_prefix(m, "");
@@ -32,4 +39,395 @@ void lop_method_pp_prefix(lop_method m, const char *p)
     printf("%suser-data: %p\n", p, m->user_data);
 }
 
+/* FNV-1a */
+uint32_t lop_method_hash(const char *path)
+{
+    uint32_t h = 2166136261U;
+
+    while (*path) {
+	h ^= (unsigned char)*path++;
+	h *= 16777619U;
+    }
+    return h;
+}
+
+/* append m to the chain starting at *link */
+static void chain_append(lop_method *link, lop_method m)
+{
+    while (*link) {
+	link = &(*link)->hash_next;
+    }
+    m->hash_next = NULL;
+    *link = m;
+}
+
+static int index_grow(lop_server s)
+{
+    unsigned int size = s->table_size ? s->table_size * 2 : LOP_DEF_TABLE_SIZE;
+    lop_method *table = calloc(size, sizeof(lop_method));
+    lop_method it;
+
+    if (!table) {
+	return -1;
+    }
+
+    /* re-insert in registration order so chains stay ordered */
+    for (it = s->first; it; it = it->next) {
+	if (it->path) {
+	    chain_append(&table[it->hash & (size - 1)], it);
+	}
+    }
+    free(s->table);
+    s->table = table;
+    s->table_size = size;
+    return 0;
+}
+
+int lop_method_index_add(lop_server s, lop_method m)
+{
+    if (!m->path) {
+	chain_append(&s->catchall, m);
+	return 0;
+    }
+
+    m->hash = lop_method_hash(m->path);
+    /* m is not on s->first yet, so growing leaves it out */
+    if (s->table_count + 1 > s->table_size) {
+	if (index_grow(s)) {
+	    return -1;
+	}
+    }
+    chain_append(&s->table[m->hash & (s->table_size - 1)], m);
+    s->table_count++;
+    return 0;
+}
+
+void lop_method_index_remove(lop_server s, lop_method m)
+{
+    lop_method *link;
+
+    if (m->path) {
+	link = &s->table[m->hash & (s->table_size - 1)];
+	s->table_count--;
+    } else {
+	link = &s->catchall;
+    }
+    while (*link && *link != m) {
+	link = &(*link)->hash_next;
+    }
+    if (*link) {
+	*link = m->hash_next;
+    }
+}
+
+lop_method lop_method_index_next(lop_method m, const char *path,
+    uint32_t hash)
+{
+    for (m = m->hash_next; m; m = m->hash_next) {
+	if (m->hash == hash && !strcmp(m->path, path)) {
+	    return m;
+	}
+    }
+    return NULL;
+}
+
+lop_method lop_method_index_find(lop_server s, const char *path,
+    uint32_t hash)
+{
+    lop_method m;
+
+    if (!s->table_size) {
+	return NULL;
+    }
+    m = s->table[hash & (s->table_size - 1)];
+    if (m && (m->hash != hash || strcmp(m->path, path))) {
+	m = lop_method_index_next(m, path, hash);
+    }
+    return m;
+}
+
+void lop_method_index_free(lop_server s)
+{
+    free(s->table);
+    s->table = NULL;
+    s->table_size = s->table_count = 0;
+    s->catchall = NULL;
+}
+
+/* Longest part name looked up without going through the automaton */
+#define LOP_TRIE_NAME_MAX 256
+
+/* Find the child of n called name. Returns its index, or if there is
+ * none, minus one minus the index it would be inserted at. */
+static int trie_find(lop_trie_node *n, const char *name)
+{
+    int lo = 0, hi = n->nchildren - 1;
+
+    while (lo <= hi) {
+	int mid = (lo + hi) / 2;
+	int cmp = strcmp(name, n->children[mid]->name);
+
+	if (cmp == 0) {
+	    return mid;
+	} else if (cmp < 0) {
+	    hi = mid - 1;
+	} else {
+	    lo = mid + 1;
+	}
+    }
+    return -1 - lo;
+}
+
+static lop_trie_node *trie_node_new(const char *name, lop_trie_node *parent)
+{
+    lop_trie_node *n = calloc(1, sizeof(lop_trie_node));
+
+    if (!n) {
+	return NULL;
+    }
+    n->name = strdup(name);
+    if (!n->name) {
+	free(n);
+	return NULL;
+    }
+    n->parent = parent;
+    return n;
+}
+
+static void trie_node_free(lop_trie_node *n)
+{
+    int i;
+
+    for (i = 0; i < n->nchildren; i++) {
+	trie_node_free(n->children[i]);
+    }
+    free(n->children);
+    free(n->name);
+    free(n);
+}
+
+/* Return the child of n called name, creating it if needed */
+static lop_trie_node *trie_child(lop_trie_node *n, const char *name)
+{
+    lop_trie_node *child;
+    int i;
+
+    i = trie_find(n, name);
+    if (i >= 0) {
+	return n->children[i];
+    }
+
+    i = -1 - i;
+    if (n->nchildren == n->children_size) {
+	int size = n->children_size ? n->children_size * 2 : 4;
+	lop_trie_node **children = realloc(n->children,
+					  size * sizeof(lop_trie_node *));
+
+	if (!children) {
+	    return NULL;
+	}
+	n->children = children;
+	n->children_size = size;
+    }
+    child = trie_node_new(name, n);
+    if (!child) {
+	return NULL;
+    }
+    memmove(n->children + i + 1, n->children + i,
+	    (n->nchildren - i) * sizeof(lop_trie_node *));
+    n->children[i] = child;
+    n->nchildren++;
+    return child;
+}
+
+int lop_method_trie_add(lop_server s, lop_method m)
+{
+    char *path, *part, *end;
+    lop_trie_node *n;
+    lop_method *link;
+
+    if (!s->trie) {
+	s->trie = trie_node_new("", NULL);
+	if (!s->trie) {
+	    return -1;
+	}
+    }
+
+    path = strdup(m->path);
+    if (!path) {
+	return -1;
+    }
+    n = s->trie;
+    for (part = path; n && part; part = end) {
+	end = strchr(part, '/');
+	if (end) {
+	    *end++ = '\0';
+	}
+	n = trie_child(n, part);
+    }
+    free(path);
+    if (!n) {
+	return -1;
+    }
+
+    for (link = &n->methods; *link; link = &(*link)->node_next);
+    m->node = n;
+    m->node_next = NULL;
+    *link = m;
+    return 0;
+}
+
+void lop_method_trie_remove(lop_server s, lop_method m)
+{
+    lop_trie_node *n = m->node, *parent;
+    lop_method *link;
+
+    if (!n) {
+	return;
+    }
+    for (link = &n->methods; *link && *link != m; link = &(*link)->node_next);
+    if (*link) {
+	*link = m->node_next;
+    }
+    m->node = NULL;
+
+    /* prune the branch back to the first node still in use */
+    while ((parent = n->parent) && !n->methods && !n->nchildren) {
+	int i = trie_find(parent, n->name);
+
+	memmove(parent->children + i, parent->children + i + 1,
+		(parent->nchildren - i - 1) * sizeof(lop_trie_node *));
+	parent->nchildren--;
+	trie_node_free(n);
+	n = parent;
+    }
+}
+
+/* Return the index of the first child whose name starts with the len
+ * bytes of prefix, or n->nchildren if there is none */
+static int trie_find_prefix(lop_trie_node *n, const char *prefix, size_t len)
+{
+    int lo = 0, hi = n->nchildren;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (strncmp(n->children[mid]->name, prefix, len) < 0) {
+	    lo = mid + 1;
+	} else {
+	    hi = mid;
+	}
+    }
+    return lo;
+}
+
+static void trie_match(lop_trie_node *n, lop_pattern p, int part,
+    void (*found)(lop_method m, void *arg), void *arg);
+
+static void trie_visit(lop_trie_node *n, lop_pattern p, int part,
+    void (*found)(lop_method m, void *arg), void *arg)
+{
+    lop_method m;
+
+    if (part + 1 < p->nparts) {
+	trie_match(n, p, part + 1, found, arg);
+    } else {
+	for (m = n->methods; m; m = m->node_next) {
+	    found(m, arg);
+	}
+    }
+}
+
+/*
+ * Look up each name spelled by a part of the form prefix{a,b,...}suffix
+ * directly, skipping repeated alternatives. Returns -1, having done
+ * nothing, if a name does not fit in the buffer.
+ */
+static int trie_match_alts(lop_trie_node *n, lop_pattern p, int part,
+    void (*found)(lop_method m, void *arg), void *arg)
+{
+    const lop_pattern_part *pp = p->parts + part;
+    const char *alts = pp->text + pp->prefix + 1;
+    const char *suffix = strchr(alts, '}') + 1;
+    size_t suffix_len = strlen(suffix);
+    char name[LOP_TRIE_NAME_MAX];
+    const char *alt, *end, *prev;
+    int i;
+
+    if (suffix - pp->text + suffix_len >= sizeof(name)) {
+	return -1;
+    }
+    memcpy(name, pp->text, pp->prefix);
+    for (alt = alts; alt < suffix; alt = end + 1) {
+	end = alt + strcspn(alt, ",}");
+	for (prev = alts; prev < alt; prev += strcspn(prev, ",") + 1) {
+	    if ((size_t)(end - alt) == strcspn(prev, ",") &&
+		!memcmp(prev, alt, end - alt)) {
+		break;
+	    }
+	}
+	if (prev < alt) {
+	    continue;
+	}
+	memcpy(name + pp->prefix, alt, end - alt);
+	memcpy(name + pp->prefix + (end - alt), suffix, suffix_len + 1);
+	i = trie_find(n, name);
+	if (i >= 0) {
+	    trie_visit(n->children[i], p, part, found, arg);
+	}
+    }
+    return 0;
+}
+
+static void trie_match(lop_trie_node *n, lop_pattern p, int part,
+    void (*found)(lop_method m, void *arg), void *arg)
+{
+    const lop_pattern_part *pp = p->parts + part;
+    int i;
+
+    if (pp->kind == LOP_PART_LITERAL) {
+	/* a literal part selects at most one branch */
+	i = trie_find(n, pp->text);
+	if (i >= 0) {
+	    trie_visit(n->children[i], p, part, found, arg);
+	}
+	return;
+    }
+    if (pp->kind == LOP_PART_ALTS && trie_match_alts(n, p, part, found,
+						     arg) == 0) {
+	return;
+    }
+
+    /* only the children sharing the literal prefix need testing */
+    for (i = trie_find_prefix(n, pp->text, pp->prefix); i < n->nchildren;
+	 i++) {
+	lop_trie_node *child = n->children[i];
+
+	if (strncmp(child->name, pp->text, pp->prefix)) {
+	    break;
+	}
+	if (pp->kind == LOP_PART_PREFIX ||
+	    lop_pattern_match_part(p, part, child->name,
+				   strlen(child->name))) {
+	    trie_visit(child, p, part, found, arg);
+	}
+    }
+}
+
+void lop_method_trie_match(lop_server s, lop_pattern p,
+    void (*found)(lop_method m, void *arg), void *arg)
+{
+    if (s->trie && p->nparts) {
+	trie_match(s->trie, p, 0, found, arg);
+    }
+}
+
+void lop_method_trie_free(lop_server s)
+{
+    if (s->trie) {
+	trie_node_free(s->trie);
+	s->trie = NULL;
+    }
+}
+
 /* vi:set ts=8 sts=4 sw=4: */
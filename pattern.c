@@ -0,0 +1,468 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+/*
+ * Compiled OSC address patterns.
+ *
+ * Each '/'-separated part of a pattern is compiled to a small
+ * nondeterministic automaton, which is run over a candidate string by
+ * tracking the set of live states in a bitmap. Every character is looked
+ * at once, so matching takes O(length * states) however the '*'s and
+ * {alternatives} are arranged, where lop_pattern_match() backtracks.
+ *
+ * The syntax is that of lop_pattern_match(): '*', '?', [set], [!set],
+ * ranges a-z inside sets and {literal,alternatives}.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+#include "lop/lop_lowlevel.h"
+
+enum {
+    OP_CHAR,	/* c, then the next state */
+    OP_ANY,	/* any character, then the next state */
+    OP_SET,	/* a character in sets[arg], then the next state */
+    OP_STAR,	/* loop on any character, or go on to the next state */
+    OP_ALT,	/* go on to any of the nalts states at alts[arg] */
+    OP_JMP,	/* go on to state arg */
+    OP_MATCH
+};
+
+#define set_has(set, c) ((set)[(unsigned char)(c) >> 3] & \
+			 (1 << ((unsigned char)(c) & 7)))
+#define set_add(set, c) ((set)[(unsigned char)(c) >> 3] |= \
+			 (1 << ((unsigned char)(c) & 7)))
+
+typedef struct {
+    lop_pattern p;
+    int nstates;
+    int nalts;
+    int nsets;
+} compiler;
+
+static int emit(compiler *cc, int op, int c, int arg)
+{
+    lop_pattern_state *st = cc->p->states + cc->nstates;
+
+    st->op = op;
+    st->c = c;
+    st->nalts = 0;
+    st->arg = arg;
+    return cc->nstates++;
+}
+
+/* Compile a bracketed set starting after the '['. Returns a pointer past
+ * the closing ']', or NULL if there is none. */
+static const char *compile_set(compiler *cc, const char *p)
+{
+    uint8_t *set = cc->p->sets[cc->nsets];
+    int negate = 0, i;
+    unsigned char c;
+
+    if (*p == '!') {
+	negate = 1;
+	p++;
+    }
+    memset(set, 0, 32);
+    /* the first character is always a member, even if it is ']' */
+    do {
+	c = *p++;
+	if (!c) {
+	    return NULL;
+	}
+	if (p[0] == '-' && p[1] && p[1] != ']') {
+	    unsigned char hi = p[1];
+
+	    /* [z-a] holds just z and a, as in lop_pattern_match() */
+	    set_add(set, c);
+	    set_add(set, hi);
+	    for (i = c + 1; i < hi; i++) {
+		set_add(set, i);
+	    }
+	    p += 2;
+	} else {
+	    set_add(set, c);
+	}
+    } while (*p != ']');
+
+    if (negate) {
+	for (i = 0; i < 32; i++) {
+	    set[i] = ~set[i];
+	}
+    }
+    emit(cc, OP_SET, 0, cc->nsets++);
+    return p + 1;
+}
+
+/* Compile {a,b,...} starting after the '{'. Every alternative is a chain
+ * of characters ending in a jump past the others. */
+static const char *compile_alts(compiler *cc, const char *p)
+{
+    const char *end = strchr(p, '}');
+    int alt, first, i, n = 1;
+
+    if (!end) {
+	return NULL;
+    }
+    for (i = 0; p + i < end; i++) {
+	n += p[i] == ',';
+    }
+
+    alt = emit(cc, OP_ALT, 0, cc->nalts);
+    cc->p->states[alt].nalts = n;
+    first = cc->nalts;
+    cc->nalts += n;
+    for (i = 0; i < n; i++) {
+	cc->p->alts[first + i] = cc->nstates;
+	while (*p != ',' && *p != '}') {
+	    emit(cc, OP_CHAR, *p++, 0);
+	}
+	p++;
+	emit(cc, OP_JMP, 0, 0);
+    }
+    /* point the jumps at the state after the braces */
+    for (i = alt; i < cc->nstates; i++) {
+	if (cc->p->states[i].op == OP_JMP) {
+	    cc->p->states[i].arg = cc->nstates;
+	}
+    }
+    return end + 1;
+}
+
+static int compile_part(compiler *cc, lop_pattern_part *part)
+{
+    const char *p = part->text, *end;
+    lop_pattern_state *states;
+    int i, j;
+
+    part->prefix = strcspn(p, "*?[{");
+    if (!p[part->prefix]) {
+	/* plain strings are compared directly */
+	part->kind = LOP_PART_LITERAL;
+	part->start = part->nstates = 0;
+	return 0;
+    } else if (!strcmp(p + part->prefix, "*")) {
+	part->kind = LOP_PART_PREFIX;
+    } else if (p[part->prefix] == '{' && (end = strchr(p + part->prefix,
+							'}')) &&
+	       !strpbrk(end, "*?[{")) {
+	part->kind = LOP_PART_ALTS;
+    } else {
+	part->kind = LOP_PART_AUTOMATON;
+    }
+
+    part->start = cc->nstates;
+    while (*p) {
+	switch (*p) {
+	case '*':
+	    while (*p == '*') {
+		p++;
+	    }
+	    emit(cc, OP_STAR, 0, 0);
+	    break;
+	case '?':
+	    p++;
+	    emit(cc, OP_ANY, 0, 0);
+	    break;
+	case '[':
+	    p = compile_set(cc, p + 1);
+	    break;
+	case '{':
+	    p = compile_alts(cc, p + 1);
+	    break;
+	default:
+	    emit(cc, OP_CHAR, *p++, 0);
+	    break;
+	}
+	if (!p) {
+	    return -1;
+	}
+    }
+    emit(cc, OP_MATCH, 0, 0);
+
+    /* jump targets and alternatives are relative to the part */
+    part->nstates = cc->nstates - part->start;
+    states = cc->p->states + part->start;
+    for (i = 0; i < part->nstates; i++) {
+	if (states[i].op == OP_JMP) {
+	    states[i].arg -= part->start;
+	} else if (states[i].op == OP_ALT) {
+	    for (j = 0; j < states[i].nalts; j++) {
+		cc->p->alts[states[i].arg + j] -= part->start;
+	    }
+	}
+    }
+
+    /* Every state without input goes forward, so the closures can be
+     * built from the last state back */
+    if (part->nstates <= 64) {
+	for (i = part->nstates - 1; i >= 0; i--) {
+	    lop_pattern_state *st = states + i;
+
+	    st->eps = (uint64_t)1 << i;
+	    if (st->op == OP_STAR) {
+		st->eps |= states[i + 1].eps;
+	    } else if (st->op == OP_JMP) {
+		st->eps |= states[st->arg].eps;
+	    } else if (st->op == OP_ALT) {
+		for (j = 0; j < st->nalts; j++) {
+		    st->eps |= states[cc->p->alts[st->arg + j]].eps;
+		}
+	    }
+	}
+    }
+    return 0;
+}
+
+lop_pattern lop_pattern_compile(const char *pattern)
+{
+    size_t len = strlen(pattern), nparts = 1, size;
+    size_t states_off, alts_off, sets_off, text_off;
+    compiler cc;
+    lop_pattern p;
+    char *text, *part;
+    int i, max = 0;
+
+    for (i = 0; pattern[i]; i++) {
+	nparts += pattern[i] == '/';
+    }
+
+    /* Every pattern character gives at most two states (a character and
+     * the jump closing its alternative), plus one final state per part.
+     * Everything lives in one block, sized for that. */
+    states_off = sizeof(struct _lop_pattern) +
+		 nparts * sizeof(lop_pattern_part);
+    alts_off = states_off + (2 * len + nparts) * sizeof(lop_pattern_state);
+    sets_off = alts_off + (len + 1) * sizeof(int);
+    text_off = sets_off + (len / 2 + 1) * 32;
+    size = text_off + len + 1;
+    p = calloc(1, size);
+    if (!p) {
+	return NULL;
+    }
+    p->parts = (lop_pattern_part *)(p + 1);
+    p->states = (lop_pattern_state *)((char *)p + states_off);
+    p->alts = (int *)((char *)p + alts_off);
+    p->sets = (uint8_t (*)[32])((char *)p + sets_off);
+    text = (char *)p + text_off;
+    memcpy(text, pattern, len + 1);
+
+    cc.p = p;
+    cc.nstates = cc.nalts = cc.nsets = 0;
+    for (part = text; part; p->nparts++) {
+	char *end = strchr(part, '/');
+
+	if (end) {
+	    *end++ = '\0';
+	}
+	p->parts[p->nparts].text = part;
+	if (compile_part(&cc, p->parts + p->nparts)) {
+	    free(p);
+	    return NULL;
+	}
+	if (p->parts[p->nparts].nstates > max) {
+	    max = p->parts[p->nparts].nstates;
+	}
+	part = end;
+    }
+
+    /* parts of up to 64 states are matched in a single word */
+    if (max > 64) {
+	p->nwords = (max + 31) / 32;
+	p->scratch = malloc(2 * p->nwords * sizeof(uint32_t));
+	if (!p->scratch) {
+	    free(p);
+	    return NULL;
+	}
+    }
+    return p;
+}
+
+void lop_pattern_free(lop_pattern p)
+{
+    if (p) {
+	free(p->scratch);
+	free(p);
+    }
+}
+
+/* Add state i, and every state reachable from it without reading a
+ * character, to the set */
+static void add_state(const lop_pattern_state *states, const int *alts,
+    uint32_t *set, int i)
+{
+    const lop_pattern_state *st;
+    int j;
+
+    for (;;) {
+	if (set[i >> 5] & (1u << (i & 31))) {
+	    return;
+	}
+	set[i >> 5] |= 1u << (i & 31);
+	st = states + i;
+	switch (st->op) {
+	case OP_STAR:
+	    i++;
+	    break;
+	case OP_JMP:
+	    i = st->arg;
+	    break;
+	case OP_ALT:
+	    for (j = 1; j < st->nalts; j++) {
+		add_state(states, alts, set, alts[st->arg + j]);
+	    }
+	    i = alts[st->arg];
+	    break;
+	default:
+	    return;
+	}
+    }
+}
+
+/* Run a part of up to 64 states, keeping the live states in one word */
+static int match_small(lop_pattern p, const lop_pattern_state *states,
+    const char *str, size_t len, int nstates)
+{
+    uint64_t cur = states[0].eps;
+    size_t k;
+
+    for (k = 0; k < len; k++) {
+	unsigned char c = str[k];
+	uint64_t bits = cur, next = 0;
+
+	while (bits) {
+	    const lop_pattern_state *st = states + __builtin_ctzll(bits);
+
+	    bits &= bits - 1;
+	    switch (st->op) {
+	    case OP_CHAR:
+		if (st->c == c) {
+		    next |= st[1].eps;
+		}
+		break;
+	    case OP_ANY:
+		next |= st[1].eps;
+		break;
+	    case OP_SET:
+		if (set_has(p->sets[st->arg], c)) {
+		    next |= st[1].eps;
+		}
+		break;
+	    case OP_STAR:
+		next |= st->eps;
+		break;
+	    }
+	}
+	if (!next) {
+	    return 0;
+	}
+	cur = next;
+    }
+    return (cur >> (nstates - 1)) & 1;
+}
+
+int lop_pattern_match_part(lop_pattern p, int n, const char *str,
+    size_t len)
+{
+    const lop_pattern_part *part = p->parts + n;
+    const lop_pattern_state *states = p->states + part->start;
+    uint32_t *cur = p->scratch, *next = p->scratch + p->nwords, *tmp;
+    int nwords = (part->nstates + 31) / 32;
+    size_t k;
+    int w;
+
+    if (part->kind == LOP_PART_LITERAL) {
+	return strlen(part->text) == len && !memcmp(part->text, str, len);
+    }
+    if (len < part->prefix || memcmp(part->text, str, part->prefix)) {
+	return 0;
+    }
+    if (part->kind == LOP_PART_PREFIX) {
+	return 1;
+    }
+    if (part->nstates <= 64) {
+	return match_small(p, states, str, len, part->nstates);
+    }
+
+    memset(cur, 0, nwords * sizeof(uint32_t));
+    add_state(states, p->alts, cur, 0);
+    for (k = 0; k < len; k++) {
+	unsigned char c = str[k];
+	uint32_t live = 0;
+
+	memset(next, 0, nwords * sizeof(uint32_t));
+	for (w = 0; w < nwords; w++) {
+	    uint32_t bits = cur[w];
+
+	    while (bits) {
+		int i = w * 32 + __builtin_ctz(bits);
+		const lop_pattern_state *st = states + i;
+
+		bits &= bits - 1;
+		switch (st->op) {
+		case OP_CHAR:
+		    if (st->c == c) {
+			add_state(states, p->alts, next, i + 1);
+		    }
+		    break;
+		case OP_ANY:
+		    add_state(states, p->alts, next, i + 1);
+		    break;
+		case OP_SET:
+		    if (set_has(p->sets[st->arg], c)) {
+			add_state(states, p->alts, next, i + 1);
+		    }
+		    break;
+		case OP_STAR:
+		    add_state(states, p->alts, next, i);
+		    break;
+		}
+	    }
+	}
+	for (w = 0; w < nwords; w++) {
+	    live |= next[w];
+	}
+	if (!live) {
+	    return 0;
+	}
+	tmp = cur;
+	cur = next;
+	next = tmp;
+    }
+
+    w = part->nstates - 1;
+    return (cur[w >> 5] >> (w & 31)) & 1;
+}
+
+int lop_pattern_exec(lop_pattern p, const char *path)
+{
+    int n;
+
+    for (n = 0; n < p->nparts; n++) {
+	const char *end = strchr(path, '/');
+	size_t len = end ? (size_t)(end - path) : strlen(path);
+
+	if (!end != (n == p->nparts - 1) ||
+	    !lop_pattern_match_part(p, n, path, len)) {
+	    return 0;
+	}
+	path = end + 1;
+    }
+    return 1;
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
@@ -0,0 +1,115 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+/*
+ * Event schedule: a binary min-heap of (time, sequence number) keys.
+ * The sequence number increases with every push, so events due at the
+ * same time come out in the order they were scheduled. Times are
+ * compared by their signed difference, as timetags are, so the order
+ * holds across an NTP era rollover.
+ */
+
+#include <stdlib.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+
+/* Initial heap capacity, grown by doubling */
+#define LOP_DEF_SCHED_SIZE 64
+
+#define entry_before(a, b) ((int64_t)((a)->time - (b)->time) < 0 || \
+			    ((a)->time == (b)->time && (a)->seq < (b)->seq))
+
+int lop_sched_push(lop_sched *q, uint64_t time, void *item)
+{
+    lop_sched_entry e, *heap;
+    unsigned int i;
+
+    if (q->count == q->size) {
+	unsigned int size = q->size ? q->size * 2 : LOP_DEF_SCHED_SIZE;
+
+	heap = realloc(q->heap, size * sizeof(lop_sched_entry));
+	if (!heap) {
+	    return -1;
+	}
+	q->heap = heap;
+	q->size = size;
+    }
+
+    e.time = time;
+    e.seq = q->seq++;
+    e.item = item;
+
+    /* sift the hole up from the end */
+    heap = q->heap;
+    for (i = q->count++; i > 0; ) {
+	unsigned int parent = (i - 1) / 2;
+
+	if (!entry_before(&e, &heap[parent])) {
+	    break;
+	}
+	heap[i] = heap[parent];
+	i = parent;
+    }
+    heap[i] = e;
+    return 0;
+}
+
+void *lop_sched_peek(lop_sched *q, uint64_t *time)
+{
+    if (!q->count) {
+	return NULL;
+    }
+    if (time) {
+	*time = q->heap[0].time;
+    }
+    return q->heap[0].item;
+}
+
+void *lop_sched_pop(lop_sched *q)
+{
+    lop_sched_entry *heap = q->heap, *last;
+    unsigned int i, child;
+    void *item;
+
+    if (!q->count) {
+	return NULL;
+    }
+    item = heap[0].item;
+    last = &heap[--q->count];
+
+    /* sift the hole left at the root down, then fill it with the last
+     * entry */
+    for (i = 0; (child = 2 * i + 1) < q->count; i = child) {
+	if (child + 1 < q->count && entry_before(&heap[child + 1],
+						 &heap[child])) {
+	    child++;
+	}
+	if (!entry_before(&heap[child], last)) {
+	    break;
+	}
+	heap[i] = heap[child];
+    }
+    heap[i] = *last;
+    return item;
+}
+
+void lop_sched_free(lop_sched *q)
+{
+    free(q->heap);
+    q->heap = NULL;
+    q->count = q->size = 0;
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
@@ -19,8 +19,8 @@
 #include <string.h>
 #include <strings.h>
 #include <errno.h>
-#include <float.h>
 #include <sys/types.h>
+#include <time.h>
 
 #include <unistd.h>
 
@@ -29,23 +29,100 @@
 #include "lop_types_internal.h"
 #include "lop_internal.h"
 #include "lop/lop_throw.h"
+#include "lop/lop_timetag.h"
 #include "lop/lop_lowlevel.h"
 #include "lop/lop_endian.h"
 
+static int dispatch_data_view(lop_server s, void *data, size_t size,
+    ssize_t path_size, lop_timetag ts);
 static void dispatch_method(lop_server s, const char *path,
     lop_message msg);
-static void dispatch_queued(lop_server s);
-static void queue_data(lop_server s, lop_timetag ts, const char *path,
-    lop_message msg);
-static int lop_can_coerce(char a, char b);
-static int lop_can_coerce_spec(const char *a, const char *b);
+static int dispatch_queued(lop_server s);
+static int queue_data(lop_server s, lop_timetag ts, void *data,
+    size_t size);
+static int dispatch_data(lop_server s, void *data, size_t size);
+static void server_now(lop_server s, lop_timetag *t);
+static void dispatch_done(lop_server s);
+static void method_free(lop_method m);
+static void dispatch_cache_release(lop_server s);
+
+/* Arguments that fit in the stack array of a zero-copy dispatch */
+#define LOP_DISPATCH_ARGS 64
+
+/* Compiled address patterns kept by each server */
+#define LOP_DEF_PATTERN_CACHE 64
+
+/* Pattern matches collected on the stack before spilling to the heap */
+#define LOP_DISPATCH_METHODS 64
+
+/* Resolved (path, types) dispatches kept by each server */
+#define LOP_DEF_DISPATCH_CACHE 1024
+
+/* Longest dispatch cache key built on the stack */
+#define LOP_DISPATCH_KEY 256
+
+/* Most pieces a message is sent in through a server's send_iov handler */
+#define LOP_SEND_IOV 16
+
+/* Deepest nesting of bundles dispatched, so a packet cannot exhaust the
+ * stack */
+#define LOP_MAX_BUNDLE_DEPTH 8
+
+/* Microseconds lop_server_wait_until_next() busy-polls before a deadline */
+#define LOP_DEF_WAIT_SPIN 100
+
+/* The methods a message goes to, and how to coerce it for each */
+typedef struct {
+    lop_method m;
+    /* pass the method its own typespec and converted arguments */
+    int coerce;
+    int nsteps;
+    int nslots;
+    lop_coerce_step *steps;
+} lop_dispatch_target;
 
+typedef struct {
+    /* stop at the first handler that returns 0 */
+    int exact;
+    int count;
+    lop_dispatch_target *targets;
+} lop_dispatch_plan;
+
+/* Initial arena chunk, enough for the coercion buffers of typical traffic */
+#define LOP_DEF_ARENA_SIZE 4096
+
+/* A scheduled bundle element. The argv array and a private copy of the
+ * element data follow the structure in the same block. */
 typedef struct {
     lop_timetag ts;
-    char *path;
-    lop_message msg;
-    void *next;
-} queued_msg_list;
+    lop_message_view view;
+} queued_msg;
+
+/* Scheduled events are dispatched up to this far ahead of their
+ * timetag, in 2^-32 s units (about 120ns) */
+#define LOP_SCHED_SLACK 512
+
+/* Allocate memory that is only needed until the current call to
+ * lop_server_dispatch_data() or lop_server_dispatch_batch() returns. */
+static void *server_alloc(lop_server s, size_t size)
+{
+    if (s->arena.chunk) {
+        return lop_arena_alloc(&s->arena, size);
+    }
+    return malloc(size);
+}
+
+static void server_release(lop_server s, void *ptr)
+{
+    if (!s->arena.chunk) {
+        free(ptr);
+    }
+}
+
+static void pattern_free(void *p)
+{
+    lop_pattern_free(p);
+}
 
 lop_server lop_server_new(lop_err_handler err_h, lop_send_handler send_h, void *send_h_arg)
 {
@@ -57,6 +134,16 @@ lop_server lop_server_new(lop_err_handler err_h, lop_send_handler send_h, void *
     s->err_h = err_h;
     s->send_h = send_h;
     s->send_h_arg = send_h_arg;
+    s->wait_spin = LOP_DEF_WAIT_SPIN;
+    if (lop_cache_init(&s->patterns, LOP_DEF_PATTERN_CACHE, pattern_free)) {
+	free(s);
+	return NULL;
+    }
+    if (lop_cache_init(&s->resolved, LOP_DEF_DISPATCH_CACHE, free)) {
+	lop_cache_free(&s->patterns);
+	free(s);
+	return NULL;
+    }
     
     return s;
 }
@@ -65,24 +152,258 @@ void lop_server_free(lop_server s)
 {
     lop_method it;
     lop_method next;
+    queued_msg *q;
     
-#warning free s->queued ?
+    while ((q = lop_sched_pop(&s->queued))) {
+        lop_pool_release(&s->sched_pool, q);
+    }
+    lop_sched_free(&s->queued);
     for (it = s->first; it; it = next) {
         next = it->next;
-        free((char *)it->path);
-        free((char *)it->typespec);
-        free(it);
+        method_free(it);
     }
+    lop_method_index_free(s);
+    lop_method_trie_free(s);
+    lop_cache_free(&s->patterns);
+    lop_cache_free(&s->resolved);
+    lop_arena_free(&s->arena);
+    lop_pool_free(&s->sched_pool);
+    free(s->send_buf);
     free(s);
 }
 
+int lop_server_enable_arena(lop_server s, size_t size)
+{
+    if (s->arena.chunk) {
+        return 0;
+    }
+    if (s->queued.count) {
+        return -1;
+    }
+    if (lop_arena_init(&s->arena, size ? size : LOP_DEF_ARENA_SIZE)) {
+        return -1;
+    }
+    s->sched_pool.enabled = 1;
+    return 0;
+}
+
+void lop_server_pattern_cache_stats(lop_server s, unsigned long *hits,
+    unsigned long *misses)
+{
+    if (hits) *hits = s->patterns.hits;
+    if (misses) *misses = s->patterns.misses;
+}
+
+void lop_server_dispatch_cache_stats(lop_server s, unsigned long *hits,
+    unsigned long *misses)
+{
+    if (hits) *hits = s->resolved.hits;
+    if (misses) *misses = s->resolved.misses;
+}
+
+void lop_server_set_clock(lop_server s, lop_clock_handler clock, void *arg)
+{
+    s->clock = clock;
+    s->clock_arg = arg;
+    s->now_valid = s->now_latched = s->now_virtual = 0;
+}
+
+void lop_server_set_send_iov(lop_server s, lop_send_iov_handler send_iov,
+    void *arg)
+{
+    s->send_iov_h = send_iov;
+    s->send_iov_h_arg = arg;
+}
+
+void lop_server_latch_time(lop_server s)
+{
+    if (s->now_virtual) {
+	return;
+    }
+    s->now_valid = 0;
+    server_now(s, &s->now);
+    s->now_valid = s->now_latched = 1;
+}
+
+void lop_server_unlatch_time(lop_server s)
+{
+    s->now_valid = s->now_latched = s->now_virtual = 0;
+}
+
+void lop_server_set_virtual_time(lop_server s, lop_timetag t)
+{
+    s->now = t;
+    s->now_valid = s->now_latched = s->now_virtual = 1;
+}
+
+int lop_server_advance_time(lop_server s, lop_timetag t)
+{
+    queued_msg *head;
+    int count = 0;
+
+    if (!s->now_virtual) {
+	lop_server_set_virtual_time(s, t);
+    }
+
+    /* step through the due events one timetag at a time, so the handlers
+     * see the time each was scheduled for and anything they schedule in
+     * between still comes out in order */
+    while ((head = lop_sched_peek(&s->queued, NULL)) &&
+	   lop_timetag_sub(head->ts, t) < LOP_SCHED_SLACK) {
+	if (lop_timetag_cmp(head->ts, s->now) > 0) {
+	    s->now = head->ts;
+	}
+	s->dispatch_depth++;
+	count += dispatch_queued(s);
+	dispatch_done(s);
+    }
+    if (lop_timetag_cmp(t, s->now) > 0) {
+	s->now = t;
+    }
+    return count;
+}
+
+/* Return the current time by the server's clock. Within a dispatch the
+ * clock is read once and the time reused. */
+static void server_now(lop_server s, lop_timetag *t)
+{
+    if (!s->now_valid) {
+	if (s->clock) {
+	    s->clock(&s->now, s->clock_arg);
+	} else {
+	    lop_timetag_now(&s->now);
+	}
+	s->now_valid = s->dispatch_depth > 0 || s->now_latched;
+    }
+    *t = s->now;
+}
+
 int lop_server_dispatch_data(lop_server s, void *data, size_t size)
+{
+    int result;
+
+    s->dispatch_depth++;
+    dispatch_queued(s);
+    result = dispatch_data(s, data, size);
+    dispatch_done(s);
+    return result;
+}
+
+int lop_server_dispatch_batch(lop_server s, const struct iovec *packets,
+    int count, int *status)
+{
+    int i, dispatched = 0;
+
+    /* one clock read, queue flush and arena reset for the lot */
+    s->dispatch_depth++;
+    dispatch_queued(s);
+    for (i = 0; i < count; i++) {
+	int result = dispatch_data(s, packets[i].iov_base,
+				   packets[i].iov_len);
+
+	if (status) {
+	    status[i] = result;
+	}
+	if (result >= 0) {
+	    dispatched++;
+	}
+    }
+    dispatch_done(s);
+    return dispatched;
+}
+
+/* Leave a dispatch, tidying up after the outermost one */
+static void dispatch_done(lop_server s)
+{
+    if (--s->dispatch_depth == 0) {
+        if (!s->now_latched) {
+            s->now_valid = 0;
+        }
+        if (s->arena.chunk) {
+            lop_arena_reset(&s->arena);
+        }
+        if (s->resolved_stale) {
+            dispatch_cache_release(s);
+        }
+    }
+}
+
+/* Dispatch or schedule the elements of a bundle, len the padded size of
+ * its "#bundle" string. A bundle nested in another is due no earlier than
+ * the enclosing one, outer. */
+static int dispatch_bundle(lop_server s, char *data, size_t size,
+    ssize_t len, lop_timetag outer, int depth)
+{
+    char *pos;
+    int remain, result;
+    uint32_t elem_len;
+    lop_timetag ts, now;
+    int immediate;
+
+    ssize_t bundle_result = lop_validate_bundle(data, size);
+    if (bundle_result < 0) {
+        lop_throw(s, -bundle_result, "Invalid bundle", NULL);
+        return bundle_result;
+    }
+    pos = data + len;
+    remain = size - len;
+
+    server_now(s, &now);
+    ts.sec = lop_otoh32(*((uint32_t *)pos));
+    pos += 4;
+    ts.frac = lop_otoh32(*((uint32_t *)pos));
+    pos += 4;
+    remain -= 8;
+
+    if (depth && ((ts.sec == LOP_TT_IMMEDIATE.sec &&
+                   ts.frac == LOP_TT_IMMEDIATE.frac) ||
+                  lop_timetag_cmp(ts, outer) < 0)) {
+        ts = outer;
+    }
+
+    // test for immediate dispatch
+    immediate = (ts.sec == LOP_TT_IMMEDIATE.sec
+                 && ts.frac == LOP_TT_IMMEDIATE.frac) ||
+                lop_timetag_cmp(ts, now) <= 0;
+
+    while (remain >= 4) {
+        elem_len = lop_otoh32(*((uint32_t *)pos));
+        pos += 4;
+        remain -= 4;
+        if (elem_len >= 16 && !memcmp(pos, "#bundle", 8)) {
+            if (depth == LOP_MAX_BUNDLE_DEPTH) {
+                lop_throw(s, LOP_EINVALIDBUND, "Bundles nested too deep",
+                          NULL);
+                return -LOP_EINVALIDBUND;
+            }
+            result = dispatch_bundle(s, pos, elem_len, 8, ts, depth + 1);
+            if (result < 0) {
+                return result;
+            }
+        } else {
+            if (immediate) {
+                result = dispatch_data_view(s, pos, elem_len, 0, ts);
+            } else {
+                result = queue_data(s, ts, pos, elem_len);
+            }
+            if (result) {
+                lop_throw(s, result, "Invalid bundle element received",
+                          data);
+                return -result;
+            }
+        }
+        pos += elem_len;
+        remain -= elem_len;
+    }
+    return size;
+}
+
+static int dispatch_data(lop_server s, void *data, size_t size)
 {
     int result;
     char *path;
     ssize_t len;
     
-    dispatch_queued(s);
     if (size == 0)
         return 0;
     
@@ -95,157 +416,514 @@ int lop_server_dispatch_data(lop_server s, void *data, size_t size)
     }
 
     if (!strcmp(data, "#bundle")) {
-        char *pos;
-        int remain;
-        uint32_t elem_len;
-        lop_timetag ts, now;
-
-        ssize_t bundle_result = lop_validate_bundle(data, size);
-        if (bundle_result < 0) {
-            lop_throw(s, -bundle_result, "Invalid bundle", NULL);
-            return bundle_result;
-        }
-        pos = (char *)data + len;
-        remain = size - len;
-
-        lop_timetag_now(&now);
-        ts.sec = lop_otoh32(*((uint32_t *)pos));
-        pos += 4;
-        ts.frac = lop_otoh32(*((uint32_t *)pos));
-        pos += 4;
-        remain -= 8;
-
-        while (remain >= 4) {
-            lop_message msg;
-            elem_len = lop_otoh32(*((uint32_t *)pos));
-            pos += 4;
-            remain -= 4;
-            msg = lop_message_deserialise(pos, elem_len, &result);
-            if (!msg) {
-                lop_throw(s, result, "Invalid bundle element received", path);
-                return -result;
-            }
+        return dispatch_bundle(s, data, size, len, LOP_TT_IMMEDIATE, 0);
+    }
+    result = dispatch_data_view(s, data, size, len, LOP_TT_IMMEDIATE);
+    if (result) {
+        lop_throw(s, result, "Invalid message received", path);
+        return -result;
+    }
+    return size;
+}
 
-	    // set timetag from bundle
-	    msg->ts = ts;
+/* Validate the message in data in place and dispatch it without copying.
+ * path_size is the padded size of the path if it has been validated
+ * already, otherwise 0. Returns 0 or an LOP_E* error code. */
+static int dispatch_data_view(lop_server s, void *data, size_t size,
+    ssize_t path_size, lop_timetag ts)
+{
+    lop_arg *stack_argv[LOP_DISPATCH_ARGS];
+    lop_arg **argv = stack_argv;
+    lop_message_view v;
+    struct _lop_message msg;
+    int result;
 
-            // test for immediate dispatch
-            if ((ts.sec == LOP_TT_IMMEDIATE.sec
-                 && ts.frac == LOP_TT_IMMEDIATE.frac) ||
-                                lop_timetag_diff(ts, now) <= 0.0) {
-                dispatch_method(s, pos, msg);
-                lop_message_free(msg);
-            } else {
-                queue_data(s, ts, pos, msg);
-            }
-            pos += elem_len;
-            remain -= elem_len;
+    result = lop_message_view_parse(&v, data, size, path_size, argv,
+                                    LOP_DISPATCH_ARGS);
+    if (result == LOP_TOOBIG) {
+        /* too many arguments for the stack */
+        argv = server_alloc(s, v.argc * sizeof(lop_arg *));
+        if (!argv) {
+            return LOP_EALLOC;
         }
-    } else {
-        lop_message msg = lop_message_deserialise(data, size, &result);
-        if (NULL == msg) {
-            lop_throw(s, result, "Invalid message received", path);
-            return -result;
-        }
-        dispatch_method(s, data, msg);
-        lop_message_free(msg);
+        result = lop_message_view_parse(&v, data, size, path_size, argv,
+                                        v.argc);
     }
-    return size;
+    if (result == 0) {
+        lop_message_from_view(&msg, &v);
+        msg.ts = ts;
+        dispatch_method(s, v.path, &msg);
+    }
+
+    if (argv != stack_argv) {
+        server_release(s, argv);
+    }
+    return result;
 }
 
 /* returns the time in seconds until the next scheduled event */
 double lop_server_next_event_delay(lop_server s)
 {
-    if (s->queued) {
+    queued_msg *q = lop_sched_peek(&s->queued, NULL);
+
+    if (q) {
 	lop_timetag now;
-	double delay;
+	int64_t delay;
+
+	server_now(s, &now);
+	delay = lop_timetag_sub(q->ts, now);
+	if (delay <= 0) {
+	    return 0.0;
+	}
+	if (delay >= (int64_t)100 << 32) {
+	    return 100.0;
+	}
+	return delay / 4294967296.0;
+    }
 
-	lop_timetag_now(&now);
-	delay = lop_timetag_diff(((queued_msg_list *)s->queued)->ts, now);
+    return 100.0;
+}
 
-	delay = delay > 100.0 ? 100.0 : delay;
-	delay = delay < 0.0 ? 0.0 : delay;
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
 
-	return delay;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Sleep until the monotonic clock reads wake ns */
+static void sleep_until(int64_t wake)
+{
+    struct timespec ts;
+
+#ifdef TIMER_ABSTIME
+    ts.tv_sec = wake / 1000000000;
+    ts.tv_nsec = wake % 1000000000;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+	   EINTR)
+	;
+#else
+    int64_t left;
+
+    while ((left = wake - monotonic_ns()) > 0) {
+	ts.tv_sec = left / 1000000000;
+	ts.tv_nsec = left % 1000000000;
+	nanosleep(&ts, NULL);
     }
+#endif
+}
 
-    return 100.0;
+void lop_server_set_wait_spin(lop_server s, unsigned int spin_us)
+{
+    s->wait_spin = spin_us;
+}
+
+int lop_server_wait_until_next(lop_server s, int timeout_ms)
+{
+    queued_msg *head = lop_sched_peek(&s->queued, NULL);
+    int64_t limit = (int64_t)timeout_ms * 1000000, delay, end = 0, left;
+    int64_t spin = (int64_t)s->wait_spin * 1000;
+    lop_timetag now;
+    int count;
+
+    if (!head && timeout_ms < 0) {
+	return 0;
+    }
+    if (s->now_latched && !s->now_virtual) {
+	/* a held time would never reach the deadline */
+	lop_server_unlatch_time(s);
+    }
+
+    server_now(s, &now);
+    delay = head ? lop_timetag_diff_ns(head->ts, now) : limit;
+    if (timeout_ms >= 0 && delay > limit) {
+	delay = limit;
+    }
+    if (s->now_virtual) {
+	return lop_server_advance_time(s, lop_timetag_add_ns(now, delay));
+    }
+
+    /* The event is due by the server's clock, which need not keep step
+     * with the monotonic one the sleep is timed on, so sleep to spin ns
+     * short of it and then poll the server's clock until it is due. Only
+     * the timeout is kept on the monotonic clock. */
+    if (timeout_ms >= 0) {
+	end = monotonic_ns() + limit;
+    }
+    for (;;) {
+	if (head) {
+	    s->now_valid = 0;
+	    server_now(s, &now);
+	    if (lop_timetag_sub(head->ts, now) < LOP_SCHED_SLACK) {
+		break;
+	    }
+	    delay = lop_timetag_diff_ns(head->ts, now);
+	} else {
+	    delay = limit;
+	}
+	if (timeout_ms >= 0) {
+	    left = end - monotonic_ns();
+	    if (left <= 0) {
+		break;
+	    }
+	    if (delay > left) {
+		delay = left;
+	    }
+	}
+	if (delay > spin) {
+	    sleep_until(monotonic_ns() + delay - spin);
+	}
+    }
+
+    s->dispatch_depth++;
+    count = dispatch_queued(s);
+    dispatch_done(s);
+    return count;
 }
 
 static void lop_send_message(lop_server s, const char *path, lop_message msg)
 {
-    const size_t data_len = lop_message_length(msg, path);
-    char *data = lop_message_serialise(msg, path, NULL, NULL);
+    /* the server's buffer is taken while in use, so that a message sent
+     * from within a send handler gets one of its own */
+    char *data = s->send_buf;
+    size_t size = s->send_buf_size, len = lop_message_length(msg, path);
+    struct iovec iov[LOP_SEND_IOV];
+    int n;
+
+    s->send_buf = NULL;
+    s->send_buf_size = 0;
+    if (len > size) {
+	char *grown = realloc(data, len);
+
+	if (!grown) {
+	    lop_throw(s, LOP_EALLOC, "Out of memory for message", path);
+	    goto out;
+	}
+	data = grown;
+	size = len;
+    }
+    if (s->send_iov_h) {
+	n = lop_message_serialise_iov(msg, path, iov, LOP_SEND_IOV, data,
+				      size);
+	if (n < 0) {
+	    /* too many pieces: send it whole */
+	    lop_message_serialise_into(msg, path, data, size);
+	    iov[0].iov_base = data;
+	    iov[0].iov_len = len;
+	    n = 1;
+	}
+	s->send_iov_h(iov, n, len, s->send_iov_h_arg);
+    } else {
+	lop_message_serialise_into(msg, path, data, size);
+	s->send_h(data, len, s->send_h_arg);
+    }
+
+out:
+    free(s->send_buf);
+    s->send_buf = data;
+    s->send_buf_size = size;
+}
+
+/* Methods a message goes to, collected before dispatch */
+typedef struct {
+    lop_server s;
+    lop_method *v;
+    int count;
+    int size;
+} method_list;
+
+static void method_list_add(lop_method m, void *arg)
+{
+    method_list *l = arg;
+
+    if (l->count == l->size) {
+	lop_method *v = server_alloc(l->s, l->size * 2 * sizeof(lop_method));
+
+	if (!v) {
+	    return;
+	}
+	memcpy(v, l->v, l->count * sizeof(lop_method));
+	if (l->size != LOP_DISPATCH_METHODS) {
+	    server_release(l->s, l->v);
+	}
+	l->v = v;
+	l->size *= 2;
+    }
+    l->v[l->count++] = m;
+}
+
+static int method_seq_cmp(const void *a, const void *b)
+{
+    const lop_method ma = *(const lop_method *)a;
+    const lop_method mb = *(const lop_method *)b;
+
+    return ma->seq < mb->seq ? -1 : ma->seq > mb->seq;
+}
+
+/* Collect the methods registered for path, in registration order */
+static void find_methods(lop_server s, const char *path, int pattern,
+    method_list *found)
+{
+    lop_method it;
+
+    if (pattern) {
+	lop_pattern p, owned = NULL;
+
+	for (it = s->catchall; it; it = it->hash_next) {
+	    method_list_add(it, found);
+	}
+	p = lop_cache_get(&s->patterns, path, strlen(path));
+	if (!p) {
+	    p = lop_pattern_compile(path);
+	    if (p && lop_cache_put(&s->patterns, path, strlen(path), p)) {
+		owned = p;
+	    }
+	}
+	if (p) {
+	    lop_method_trie_match(s, p, method_list_add, found);
+	    lop_pattern_free(owned);
+	}
+	qsort(found->v, found->count, sizeof(lop_method), method_seq_cmp);
+    } else {
+	uint32_t hash = lop_method_hash(path);
+	lop_method exact = lop_method_index_find(s, path, hash);
+	lop_method any = s->catchall;
+
+	/* merge the methods registered at path with the generic ones */
+	while (exact || any) {
+	    if (!any || (exact && exact->seq < any->seq)) {
+		method_list_add(exact, found);
+		exact = lop_method_index_next(exact, path, hash);
+	    } else {
+		method_list_add(any, found);
+		any = any->hash_next;
+	    }
+	}
+    }
+}
+
+/*
+ * Work out which methods a message of the given path and types goes to
+ * and how to coerce it for each, as one block that can be freed with
+ * free(). Methods whose typespec the types cannot be coerced to are
+ * left out.
+ */
+static lop_dispatch_plan *resolve(lop_server s, const char *path,
+    const char *types)
+{
+    lop_method stack_found[LOP_DISPATCH_METHODS];
+    lop_coerce_plan *plans[LOP_DISPATCH_METHODS], **plan = plans;
+    lop_dispatch_plan *d = NULL;
+    lop_coerce_step *steps;
+    method_list found;
+    int i, n, nsteps = 0;
+
+    found.s = s;
+    found.v = stack_found;
+    found.count = 0;
+    found.size = LOP_DISPATCH_METHODS;
+    find_methods(s, path, strpbrk(path, " #*,?[]{}") != NULL, &found);
+    if (found.count > LOP_DISPATCH_METHODS) {
+	plan = server_alloc(s, found.count * sizeof(lop_coerce_plan *));
+	if (!plan) {
+	    goto out;
+	}
+    }
+
+    for (i = 0; i < found.count; i++) {
+	lop_method it = found.v[i];
+
+	plan[i] = NULL;
+	if (it->typespec && strcmp(types, it->typespec)) {
+	    plan[i] = lop_coerce_plan_get(it, types);
+	    if (!plan[i]) {
+		goto out;
+	    }
+	    nsteps += plan[i]->nsteps;
+	}
+    }
+
+    d = malloc(sizeof(lop_dispatch_plan) +
+	       found.count * sizeof(lop_dispatch_target) +
+	       nsteps * sizeof(lop_coerce_step));
+    if (!d) {
+	goto out;
+    }
+    d->exact = !strpbrk(path, " #*,?[]{}");
+    d->targets = (lop_dispatch_target *)(d + 1);
+    steps = (lop_coerce_step *)(d->targets + found.count);
+    for (i = n = 0; i < found.count; i++) {
+	lop_dispatch_target *t = d->targets + n;
+
+	if (plan[i] && !plan[i]->ok) {
+	    continue;
+	}
+	t->m = found.v[i];
+	t->coerce = plan[i] != NULL;
+	t->nsteps = 0;
+	t->nslots = 0;
+	t->steps = steps;
+	if (t->coerce) {
+	    t->nsteps = plan[i]->nsteps;
+	    t->nslots = plan[i]->nslots;
+	    memcpy(steps, plan[i]->steps, t->nsteps * sizeof(lop_coerce_step));
+	    steps += t->nsteps;
+	}
+	n++;
+    }
+    d->count = n;
+
+out:
+    if (plan != plans) {
+	server_release(s, plan);
+    }
+    if (found.v != stack_found) {
+	server_release(s, found.v);
+    }
+    return d;
+}
+
+/*
+ * Return the dispatch plan for path and the argc types, from the cache
+ * where possible. *owned is set if the plan could not be cached and must
+ * be freed by the caller.
+ */
+static lop_dispatch_plan *dispatch_plan(lop_server s, const char *path,
+    const char *types, int argc, int *owned)
+{
+    char stack_key[LOP_DISPATCH_KEY], *key = stack_key;
+    size_t path_len = strlen(path), len = path_len + 1 + argc;
+    lop_dispatch_plan *d;
+
+    *owned = 1;
+    if (s->resolved_stale || !s->resolved.capacity) {
+	return resolve(s, path, types);
+    }
+
+    /* the key is the path and types, separated by their '\0' */
+    if (len > sizeof(stack_key)) {
+	key = server_alloc(s, len);
+	if (!key) {
+	    return NULL;
+	}
+    }
+    memcpy(key, path, path_len + 1);
+    memcpy(key + path_len + 1, types, len - path_len - 1);
+
+    d = lop_cache_get(&s->resolved, key, len);
+    if (d) {
+	*owned = 0;
+    } else {
+	d = resolve(s, path, types);
+	/* adding could evict a plan a handler further up is running from */
+	if (d && !s->resolved_busy &&
+	    !lop_cache_put(&s->resolved, key, len, d)) {
+	    *owned = 0;
+	}
+    }
+    if (key != stack_key) {
+	server_release(s, key);
+    }
+    return d;
+}
+
+static void method_free(lop_method m)
+{
+    free((char *)m->path);
+    free((char *)m->typespec);
+    lop_coerce_plans_free(m);
+    free(m);
+}
 
-    s->send_h(data, data_len, s->send_h_arg);
+/* Clear the dispatch cache, then free the deleted methods its plans and
+ * any running ones could have held */
+static void dispatch_cache_release(lop_server s)
+{
+    lop_cache_clear(&s->resolved);
+    s->resolved_stale = 0;
+    while (s->dead) {
+	lop_method m = s->dead;
 
-    free(data);
+	s->dead = m->next;
+	method_free(m);
+    }
+}
+
+/* Forget every resolved dispatch, once it is safe to */
+static void dispatch_cache_invalidate(lop_server s)
+{
+    if (s->dispatch_depth) {
+	/* a handler is running from a cached plan; clear the cache when
+	 * the outermost dispatch returns and bypass it until then */
+	s->resolved_stale = 1;
+    } else {
+	dispatch_cache_release(s);
+    }
 }
 
 static void dispatch_method(lop_server s, const char *path,
     lop_message msg)
 {
     char *types = msg->types + 1;
-    int argc = strlen(types);
+    int argc = msg->typelen - 1;
     lop_arg **argv = msg->argv;
+    lop_dispatch_plan *d;
     lop_method it;
     int ret = 1;
-    int pattern = strpbrk(path, " #*,?[]{}") != NULL;
-    const char *pptr;
-    
-    for (it = s->first; it; it = it->next) {
-	/* If paths match or handler is wildcard */
-	if (!it->path || !strcmp(path, it->path) ||
-	    (pattern && lop_pattern_match(it->path, path))) {
-	    /* If types match or handler is wildcard */
-	    if (!it->typespec || !strcmp(types, it->typespec)) {
-		/* Send wildcard path to generic handler, expanded path
-		  to others.
-		*/
-		pptr = path;
-		if (it->path) pptr = it->path;
-		ret = it->handler(pptr, types, argv, argc, msg,
-				      it->user_data);
-
-	    } else if (lop_can_coerce_spec(types, it->typespec)) {
-		int i;
-		int opsize = 0;
-		char *ptr = msg->data;
-		char *data_co, *data_co_ptr;
-
-		argv = calloc(argc, sizeof(lop_arg *));
-		for (i=0; i<argc; i++) {
-		    opsize += lop_arg_size(it->typespec[i], ptr);
-		    ptr += lop_arg_size(types[i], ptr);
-		}
+    int owned, i;
 
-		data_co = malloc(opsize);
-		data_co_ptr = data_co;
-		ptr = msg->data;
-		for (i=0; i<argc; i++) {
-		    argv[i] = (lop_arg *)data_co_ptr;
-		    lop_coerce(it->typespec[i], (lop_arg *)data_co_ptr,
-			      types[i], (lop_arg *)ptr);
-		    data_co_ptr += lop_arg_size(it->typespec[i], data_co_ptr);
-		    ptr += lop_arg_size(types[i], ptr);
+    d = dispatch_plan(s, path, types, argc, &owned);
+    if (!owned) {
+	s->resolved_busy++;
+    }
+    for (i = 0; d && i < d->count; i++) {
+	lop_dispatch_target *t = d->targets + i;
+	/* Send wildcard path to generic handler, expanded path
+	  to others.
+	*/
+	const char *pptr;
+
+	it = t->m;
+	if (it->dead) {
+	    /* deleted by an earlier handler of this message */
+	    continue;
+	}
+	pptr = it->path ? it->path : path;
+	if (!t->coerce) {
+	    ret = it->handler(pptr, types, argv, argc, msg, it->user_data);
+	} else {
+	    lop_arg *stack_argv[LOP_DISPATCH_ARGS], **co_argv = stack_argv;
+	    lop_arg stack_data[LOP_DISPATCH_ARGS], *data = stack_data;
+
+	    if (argc > LOP_DISPATCH_ARGS) {
+		co_argv = server_alloc(s, argc * sizeof(lop_arg *));
+		data = server_alloc(s, t->nslots * sizeof(lop_arg));
+		if (!co_argv || !data) {
+		    server_release(s, co_argv);
+		    server_release(s, data);
+		    continue;
 		}
-
-		/* Send wildcard path to generic handler, expanded path
-		  to others.
-		*/
-		pptr = path;
-		if (it->path) pptr = it->path;
-		ret = it->handler(pptr, it->typespec, argv, argc, msg,
-				      it->user_data);
-		free(argv);
-		free(data_co);
-		argv = NULL;
 	    }
+	    lop_coerce_run(t->steps, t->nsteps, argv, argc, co_argv, data);
 
-	    if (ret == 0 && !pattern) {
-		break;
+	    ret = it->handler(pptr, it->typespec, co_argv, argc, msg,
+			      it->user_data);
+	    if (co_argv != stack_argv) {
+		server_release(s, co_argv);
+		server_release(s, data);
 	    }
 	}
+	/* an exact address goes to methods until one handles it, a
+	 * pattern to every method it matches */
+	if (ret == 0 && d->exact) {
+	    break;
+	}
+    }
+    if (owned) {
+	free(d);
+    } else {
+	s->resolved_busy--;
     }
 
     /* If we find no matching methods, check for protocol level stuff */
@@ -269,20 +947,20 @@ static void dispatch_method(lop_server s, const char *path,
 		    char *tmp;
 		    char *sec;
 
-		    tmp = malloc(strlen(it->path + len) + 1);
+		    tmp = server_alloc(s, strlen(it->path + len) + 1);
 		    strcpy(tmp, it->path + len);
 		    sec = index(tmp, '/');
 		    if (sec) *sec = '\0';
 		    slend = sl;
 		    for (slit = sl; slit; slend = slit, slit = slit->next) {
 			if (!strcmp(slit->str, tmp)) {
-			    free(tmp);
+			    server_release(s, tmp);
 			    tmp = NULL;
 			    break;
 			}
 		    }
 		    if (tmp) {
-			slnew = calloc(1, sizeof(lop_strlist));
+			slnew = server_alloc(s, sizeof(lop_strlist));
 			slnew->str = tmp;
 			slnew->next = NULL;
 			if (!slend) {
@@ -299,8 +977,8 @@ static void dispatch_method(lop_server s, const char *path,
 		lop_message_add_string(reply, slit->str);
 		slnew = slit;
 		slit = slit->next;
-		free(slnew->str);
-		free(slnew);
+		server_release(s, slnew->str);
+		server_release(s, slnew);
 	    }
 	    lop_send_message(s, "#reply", reply);
 	    lop_message_free(reply);
@@ -310,80 +988,87 @@ static void dispatch_method(lop_server s, const char *path,
 
 int lop_server_events_pending(lop_server s)
 {
-    return s->queued != 0;
+    return s->queued.count != 0;
 }
 
-static void queue_data(lop_server s, lop_timetag ts, const char *path,
-    lop_message msg)
+/* Copy a bundle element into the schedule. Returns 0 or an LOP_E* error
+ * code if the element is invalid. */
+static int queue_data(lop_server s, lop_timetag ts, void *data, size_t size)
 {
-    /* insert blob into future dispatch queue */
-    queued_msg_list *it = s->queued;
-    queued_msg_list *prev = NULL;
-    queued_msg_list *ins = calloc(1, sizeof(queued_msg_list));
-
-    ins->ts = ts;
-    ins->path = strdup(path);
-    ins->msg = msg;
+    lop_message_view v;
+    queued_msg *ins;
+    size_t argv_size;
+    int result;
 
-    while (it) {
-	if (lop_timetag_diff(it->ts, ts) > 0.0) {
-	    if (prev) {
-		prev->next = ins;
-	    } else {
-		s->queued = ins;
-		ins->next = NULL;
-	    }
-	    ins->next = it;
+    /* find the argument count, this leaves data untouched */
+    result = lop_message_view_init(&v, data, size, NULL, 0);
+    if (result && result != LOP_TOOBIG) {
+        return result;
+    }
+    argv_size = v.argc * sizeof(lop_arg *);
 
-	    return;
-	}
-	prev = it;
-	it = it->next;
+    ins = lop_pool_alloc(&s->sched_pool,
+                         sizeof(queued_msg) + argv_size + size);
+    if (!ins) {
+        return LOP_EALLOC;
+    }
+    memcpy((char *)(ins + 1) + argv_size, data, size);
+    result = lop_message_view_init(&ins->view, (char *)(ins + 1) + argv_size,
+                                   size, (lop_arg **)(ins + 1), v.argc);
+    if (result) {
+        lop_pool_release(&s->sched_pool, ins);
+        return result;
     }
+    ins->ts = ts;
 
-    /* fell through, so this event is last */
-    if (prev) {
-	prev->next = ins;
-    } else {
-	s->queued = ins;
+    if (lop_sched_push(&s->queued, lop_timetag_to_fixed(ts), ins)) {
+        lop_pool_release(&s->sched_pool, ins);
+        return LOP_EALLOC;
     }
-    ins->next = NULL;
+    return 0;
 }
 
-static void dispatch_queued(lop_server s)
+static int dispatch_queued(lop_server s)
 {
-    queued_msg_list *head = s->queued;
-    queued_msg_list *tailhead;
+    queued_msg *head;
     lop_timetag disp_time;
+    int count = 0;
 
-    lop_timetag_now(&disp_time);
-    while (head && lop_timetag_diff(head->ts, disp_time) < FLT_EPSILON) {
-        char *path;
-        lop_message msg;
-	tailhead = head->next;
-        path = ((queued_msg_list *)s->queued)->path;
-        msg = ((queued_msg_list *)s->queued)->msg;
-	dispatch_method(s, path, msg);
-        free(path);
-        lop_message_free(msg);
-	free((queued_msg_list *)s->queued);
-
-	s->queued = tailhead;
-	head = tailhead;
+    if (!s->queued.count) {
+        return 0;
+    }
+    server_now(s, &disp_time);
+    while ((head = lop_sched_peek(&s->queued, NULL)) &&
+           lop_timetag_sub(head->ts, disp_time) < LOP_SCHED_SLACK) {
+        struct _lop_message msg;
+
+        /* unlink first, the handlers may dispatch more data */
+        lop_sched_pop(&s->queued);
+        lop_message_from_view(&msg, &head->view);
+        msg.ts = head->ts;
+        dispatch_method(s, head->view.path, &msg);
+        lop_pool_release(&s->sched_pool, head);
+        count++;
     }
+    return count;
 }
 
 lop_method lop_server_add_method(lop_server s, const char *path,
 			       const char *typespec, lop_method_handler h,
 			       void *user_data)
 {
-    lop_method m = calloc(1, sizeof(struct _lop_method));
+    lop_method m;
     lop_method it;
 
     if (path && strpbrk(path, " #*,?[]{}")) {
 	return NULL;
     }
 
+    m = calloc(1, sizeof(struct _lop_method));
+    if (!m) {
+	return NULL;
+    }
+
     if (path) {
 	m->path = strdup(path);
     } else {
@@ -399,6 +1084,21 @@ lop_method lop_server_add_method(lop_server s, const char *path,
     m->handler = h;
     m->user_data = user_data;
     m->next = NULL;
+    m->seq = s->method_seq++;
+
+    if (lop_method_index_add(s, m)) {
+	free((char *)m->path);
+	free((char *)m->typespec);
+	free(m);
+	return NULL;
+    }
+    if (m->path && lop_method_trie_add(s, m)) {
+	lop_method_index_remove(s, m);
+	free((char *)m->path);
+	free((char *)m->typespec);
+	free(m);
+	return NULL;
+    }
 
     /* append the new method to the list */
     if (!s->first) {
@@ -408,6 +1108,7 @@ lop_method lop_server_add_method(lop_server s, const char *path,
 	for (it=s->first; it->next; it=it->next);
 	it->next = m;
     }
+    dispatch_cache_invalidate(s);
 
     return m;
 }
@@ -415,42 +1116,37 @@ lop_method lop_server_add_method(lop_server s, const char *path,
 void lop_server_del_method(lop_server s, const char *path,
 			  const char *typespec)
 {
-    lop_method it, prev, next;
-    int pattern = 0;
-
-    if (!s->first) return;
-    if (path) pattern = strpbrk(path, " #*,?[]{}") != NULL;
+    lop_method it, *link;
+    lop_pattern pattern = NULL;
 
-    it = s->first;
-    prev = it;
-    while (it) {
-	/* incase we free it */
-	next = it->next;
+    /* match a pattern part by part, as dispatch does */
+    if (path && strpbrk(path, " #*,?[]{}")) {
+	pattern = lop_pattern_compile(path);
+    }
 
+    link = &s->first;
+    while ((it = *link)) {
 	/* If paths match or handler is wildcard */
-	if ((it->path == path) ||
-	    (path && it->path && !strcmp(path, it->path)) ||
-	    (pattern && it->path && lop_pattern_match(it->path, path))) {
+	if (((it->path == path) ||
+	     (path && it->path && !strcmp(path, it->path)) ||
+	     (pattern && it->path && lop_pattern_exec(pattern, it->path))) &&
 	    /* If types match or handler is wildcard */
-	    if ((it->typespec == typespec) ||
-		(typespec && it->typespec && !strcmp(typespec, it->typespec))
-	        ) {
-		/* Take care when removing the head. */
-		if (it == s->first) {
-		    s->first = it->next;
-		} else {
-		    prev->next = it->next;
-		}
-		next = it->next;
-		free((void *)it->path);
-		free((void *)it->typespec);
-		free(it);
-		it = prev;
-	    }
+	    ((it->typespec == typespec) ||
+	     (typespec && it->typespec && !strcmp(typespec, it->typespec)))) {
+	    *link = it->next;
+	    lop_method_index_remove(s, it);
+	    lop_method_trie_remove(s, it);
+	    /* freed with the plans that may hold it, after any running
+	     * dispatch returns */
+	    it->dead = 1;
+	    it->next = s->dead;
+	    s->dead = it;
+	} else {
+	    link = &it->next;
 	}
-	prev = it;
-	if (it) it = next;
     }
+    lop_pattern_free(pattern);
+    dispatch_cache_invalidate(s);
 }
 
 void lop_server_pp(lop_server s)
@@ -464,30 +1160,6 @@ void lop_server_pp(lop_server s)
     }
 }
 
-static int lop_can_coerce_spec(const char *a, const char *b)
-{
-    unsigned int i;
-
-    if (strlen(a) != strlen(b)) {
-	return 0;
-    }
-
-    for (i=0; a[i]; i++) {
-	if (!lop_can_coerce(a[i], b[i])) {
-	    return 0;
-	}
-    }
-
-    return 1;
-}
-
-static int lop_can_coerce(char a, char b)
-{
-    return ((a == b) ||
-           (lop_is_numerical_type(a) && lop_is_numerical_type(b)) ||
-           (lop_is_string_type(a) && lop_is_string_type (b)));
-}
-
 void lop_throw(lop_server s, int errnum, const char *message, const char *path)
 {
     if (s->err_h) {
@@ -0,0 +1,313 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ *
+ *  $Id$
+ */
+
+/*
+ * Stream decoder: frames OSC packets out of a TCP byte stream.
+ *
+ * Packets that arrive whole within one chunk are dispatched where they
+ * lie, straight out of the caller's buffer; SLIP packets are decoded in
+ * place first, which never needs more room than the encoded bytes took.
+ * Only a packet split across chunks is gathered into the stream's own
+ * buffer, which never grows past the largest packet accepted.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lop_types_internal.h"
+#include "lop_internal.h"
+#include "lop/lop_throw.h"
+#include "lop/lop_lowlevel.h"
+
+/* Largest packet a stream accepts unless told otherwise */
+#define LOP_DEF_STREAM_PACKET 65536
+
+/* First size of the buffer for split packets */
+#define LOP_DEF_STREAM_BUF 256
+
+#define SLIP_END	0xc0
+#define SLIP_ESC	0xdb
+#define SLIP_ESC_END	0xdc
+#define SLIP_ESC_ESC	0xdd
+
+/* Packets are only dispatched in place from 4 byte aligned addresses */
+#define is_aligned(p) (((uintptr_t)(p) & 3) == 0)
+
+lop_stream lop_stream_new(lop_server s, lop_stream_framing framing,
+    size_t max_packet)
+{
+    lop_stream st = calloc(1, sizeof(struct _lop_stream));
+
+    if (!st) {
+	return NULL;
+    }
+    st->server = s;
+    st->framing = framing;
+    st->max_packet = max_packet ? max_packet : LOP_DEF_STREAM_PACKET;
+    return st;
+}
+
+void lop_stream_free(lop_stream st)
+{
+    if (st) {
+	free(st->buf);
+	free(st);
+    }
+}
+
+void lop_stream_reset(lop_stream st)
+{
+    st->len = 0;
+    st->prefix_len = 0;
+    st->need = 0;
+    st->discard = 0;
+    st->escape = 0;
+}
+
+/* Make room for size bytes in the buffer, size <= max_packet */
+static int buf_reserve(lop_stream st, size_t size)
+{
+    size_t n = st->buf_size ? st->buf_size : LOP_DEF_STREAM_BUF;
+    char *buf;
+
+    if (size <= st->buf_size) {
+	return 0;
+    }
+    while (n < size) {
+	n *= 2;
+    }
+    if (n > st->max_packet) {
+	n = st->max_packet;
+    }
+    buf = realloc(st->buf, n);
+    if (!buf) {
+	lop_throw(st->server, LOP_EALLOC, "Out of memory for stream packet",
+		  NULL);
+	return -1;
+    }
+    st->buf = buf;
+    st->buf_size = n;
+    return 0;
+}
+
+static int feed_length(lop_stream st, char *pos, char *end)
+{
+    int count = 0;
+
+    while (pos < end) {
+	size_t avail = end - pos, n;
+
+	if (st->discard) {
+	    n = avail < st->discard ? avail : st->discard;
+	    st->discard -= n;
+	    pos += n;
+	    continue;
+	}
+
+	if (st->prefix_len < 4) {
+	    if (!st->prefix_len && avail >= 4) {
+		memcpy(st->prefix, pos, 4);
+		st->prefix_len = 4;
+		pos += 4;
+	    } else {
+		st->prefix[st->prefix_len++] = *pos++;
+		if (st->prefix_len < 4) {
+		    continue;
+		}
+	    }
+	    st->need = (size_t)st->prefix[0] << 24 | st->prefix[1] << 16 |
+		       st->prefix[2] << 8 | st->prefix[3];
+	    if (st->need > st->max_packet) {
+		lop_throw(st->server, LOP_TOOBIG, "Stream packet too big",
+			  NULL);
+		st->discard = st->need;
+		st->prefix_len = 0;
+	    } else if (!st->need) {
+		st->prefix_len = 0;
+	    }
+	    continue;
+	}
+
+	if (!st->len && avail >= st->need && is_aligned(pos)) {
+	    /* all here: no copy */
+	    lop_server_dispatch_data(st->server, pos, st->need);
+	    pos += st->need;
+	} else {
+	    if (buf_reserve(st, st->need)) {
+		st->discard = st->need - st->len;
+		st->len = 0;
+		st->prefix_len = 0;
+		continue;
+	    }
+	    n = st->need - st->len;
+	    if (n > avail) {
+		n = avail;
+	    }
+	    memcpy(st->buf + st->len, pos, n);
+	    st->len += n;
+	    pos += n;
+	    if (st->len < st->need) {
+		continue;
+	    }
+	    st->len = 0;
+	    lop_server_dispatch_data(st->server, st->buf, st->need);
+	}
+	st->prefix_len = 0;
+	count++;
+    }
+    return count;
+}
+
+/*
+ * Append n decoded bytes to the current SLIP packet: in place at *w if
+ * in_place, otherwise to the buffer. An oversized packet is dropped up to
+ * its END.
+ */
+static void slip_put(lop_stream st, int in_place, char *start, char **w,
+    const unsigned char *src, size_t n)
+{
+    size_t have = in_place ? (size_t)(*w - start) : st->len;
+
+    if (have + n > st->max_packet) {
+	lop_throw(st->server, LOP_TOOBIG, "Stream packet too big", NULL);
+	st->discard = 1;
+	st->len = 0;
+	*w = start;
+    } else if (in_place) {
+	if (*w != (char *)src) {
+	    memmove(*w, src, n);
+	}
+	*w += n;
+    } else if (buf_reserve(st, st->len + n)) {
+	st->discard = 1;
+	st->len = 0;
+    } else {
+	memcpy(st->buf + st->len, src, n);
+	st->len += n;
+    }
+}
+
+/* Return the first END or ESC byte in [pos, stop), or stop. Eight bytes
+ * are tested at a time with the usual has-zero-byte trick. */
+static const unsigned char *slip_scan(const unsigned char *pos,
+    const unsigned char *stop)
+{
+    const uint64_t ones = 0x0101010101010101ULL;
+    const uint64_t highs = 0x8080808080808080ULL;
+
+    while (pos < stop && ((uintptr_t)pos & 7)) {
+	if (*pos == SLIP_END || *pos == SLIP_ESC) {
+	    return pos;
+	}
+	pos++;
+    }
+    while (stop - pos >= 8) {
+	uint64_t x = *(const uint64_t *)pos;
+	uint64_t e = x ^ (ones * SLIP_END), c = x ^ (ones * SLIP_ESC);
+
+	if (((e - ones) & ~e & highs) | ((c - ones) & ~c & highs)) {
+	    break;
+	}
+	pos += 8;
+    }
+    while (pos < stop && *pos != SLIP_END && *pos != SLIP_ESC) {
+	pos++;
+    }
+    return pos;
+}
+
+static int feed_slip(lop_stream st, char *start, char *end)
+{
+    const unsigned char *pos = (unsigned char *)start;
+    const unsigned char *stop = (unsigned char *)end;
+    /* the bytes of dispatched packets are free again, so each packet is
+     * decoded to the start of the chunk */
+    char *w = start;
+    int in_place = !st->len && is_aligned(start);
+    int count = 0;
+
+    while (pos < stop) {
+	unsigned char c;
+
+	if (!st->discard && !st->escape) {
+	    const unsigned char *run = pos;
+
+	    run = slip_scan(run, stop);
+	    if (run > pos) {
+		slip_put(st, in_place, start, &w, pos, run - pos);
+		pos = run;
+		continue;
+	    }
+	}
+
+	c = *pos++;
+	if (c == SLIP_END) {
+	    if (st->discard) {
+		st->discard = 0;
+	    } else if (in_place && w > start) {
+		lop_server_dispatch_data(st->server, start, w - start);
+		count++;
+	    } else if (!in_place && st->len) {
+		lop_server_dispatch_data(st->server, st->buf, st->len);
+		count++;
+	    }
+	    st->len = 0;
+	    st->escape = 0;
+	    w = start;
+	    in_place = is_aligned(start);
+	    continue;
+	}
+	if (st->discard) {
+	    continue;
+	}
+	if (st->escape) {
+	    st->escape = 0;
+	    if (c == SLIP_ESC_END) {
+		c = SLIP_END;
+	    } else if (c == SLIP_ESC_ESC) {
+		c = SLIP_ESC;
+	    }
+	} else if (c == SLIP_ESC) {
+	    st->escape = 1;
+	    continue;
+	}
+	slip_put(st, in_place, start, &w, &c, 1);
+    }
+
+    /* keep the start of a packet the next chunk ends */
+    if (in_place && w > start) {
+	size_t n = w - start;
+
+	if (buf_reserve(st, n)) {
+	    st->discard = 1;
+	} else {
+	    memcpy(st->buf, start, n);
+	    st->len = n;
+	}
+    }
+    return count;
+}
+
+int lop_stream_feed(lop_stream st, void *data, size_t size)
+{
+    char *start = data;
+
+    if (st->framing == LOP_STREAM_SLIP) {
+	return feed_slip(st, start, start + size);
+    }
+    return feed_length(st, start, start + size);
+}
+
+/* vi:set ts=8 sts=4 sw=4: */
@@ -0,0 +1,355 @@
+/*
+ *  Regression tests for the host build of liblop.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU Lesser General Public License as
+ *  published by the Free Software Foundation; either version 2.1 of the
+ *  License, or (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU Lesser General Public License for more details.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "lop/lop_lowlevel.h"
+#include "lop/lop_endian.h"
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        fprintf(stderr, "%s:%d: %s: check failed: %s\n", __FILE__, \
+                __LINE__, __func__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+static int int_calls, float_calls;
+static lop_server server;
+
+static int del_float_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    int_calls++;
+    lop_server_del_method(server, "/x", "f");
+    /* not handled, so the message goes on to the next method */
+    return 1;
+}
+
+static int float_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    float_calls++;
+    return 0;
+}
+
+/* Dispatch a message with a single float argument to path */
+static int dispatch_float(lop_server s, const char *path, float f)
+{
+    lop_message m = lop_message_new();
+    size_t size;
+    char *packet;
+    int ret;
+
+    lop_message_add_float(m, f);
+    packet = lop_message_serialise(m, path, NULL, &size);
+    lop_message_free(m);
+    ret = lop_server_dispatch_data(s, packet, size);
+    free(packet);
+    return ret;
+}
+
+/* A handler deleting a method the same message would go to next */
+static void test_del_sibling(void)
+{
+    int i;
+
+    server = lop_server_new(NULL, NULL, NULL);
+    lop_server_add_method(server, "/x", "i", del_float_handler, NULL);
+    lop_server_add_method(server, "/x", "f", float_handler, NULL);
+
+    int_calls = float_calls = 0;
+    dispatch_float(server, "/x", 1.5f);
+    CHECK(int_calls == 1);
+    CHECK(float_calls == 0);
+
+    /* the deleted method stays gone, and may be added again */
+    for (i = 0; i < 2; i++) {
+        dispatch_float(server, "/x", 2.5f);
+    }
+    CHECK(int_calls == 3);
+    CHECK(float_calls == 0);
+    lop_server_add_method(server, "/x", "f", float_handler, NULL);
+    dispatch_float(server, "/x", 3.5f);
+    CHECK(int_calls == 4);
+    CHECK(float_calls == 0);
+    lop_server_del_method(server, "/x", "i");
+    lop_server_add_method(server, "/x", "f", float_handler, NULL);
+    dispatch_float(server, "/x", 4.5f);
+    CHECK(float_calls == 1);
+    lop_server_free(server);
+}
+
+static int nested_calls, after_calls;
+
+static int count_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    nested_calls++;
+    return 0;
+}
+
+static int nesting_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    char nested[32];
+    int i;
+
+    /* more distinct addresses than the dispatch cache holds */
+    for (i = 0; i < 2048; i++) {
+        snprintf(nested, sizeof(nested), "/nested/%d", i);
+        dispatch_float(server, nested, 0.0f);
+    }
+    return 1;
+}
+
+static int after_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    after_calls++;
+    return 0;
+}
+
+/* Dispatching from a handler must not evict the plan it runs from */
+static void test_nested_dispatch(void)
+{
+    int i;
+
+    server = lop_server_new(NULL, NULL, NULL);
+    lop_server_add_method(server, "/outer", "f", nesting_handler, NULL);
+    lop_server_add_method(server, "/outer", "f", after_handler, NULL);
+    lop_server_add_method(server, NULL, NULL, count_handler, NULL);
+
+    nested_calls = after_calls = 0;
+    for (i = 0; i < 2; i++) {
+        dispatch_float(server, "/outer", 1.0f);
+    }
+    CHECK(nested_calls == 2 * 2048);
+    CHECK(after_calls == 2);
+    lop_server_free(server);
+}
+
+/* Deleting by pattern removes the methods dispatch would match */
+static void test_del_pattern(void)
+{
+    server = lop_server_new(NULL, NULL, NULL);
+    lop_server_add_method(server, "/a/b", "f", float_handler, NULL);
+    lop_server_add_method(server, "/a/b/c", "f", float_handler, NULL);
+    lop_server_add_method(server, "/a/d", "f", float_handler, NULL);
+
+    lop_server_del_method(server, "/a/*", NULL);
+    float_calls = 0;
+    dispatch_float(server, "/a/b", 1.0f);
+    dispatch_float(server, "/a/d", 1.0f);
+    CHECK(float_calls == 2);
+
+    lop_server_del_method(server, "/a/*", "f");
+    float_calls = 0;
+    dispatch_float(server, "/a/b", 1.0f);
+    dispatch_float(server, "/a/d", 1.0f);
+    dispatch_float(server, "/a/b/c", 1.0f);
+    CHECK(float_calls == 1);
+    lop_server_free(server);
+}
+
+static int32_t int_arg;
+
+static int int_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    int_arg = argv[0]->i;
+    return 0;
+}
+
+/* Floating point values out of an integer's range are clamped */
+static void test_coerce_clamp(void)
+{
+    lop_arg from, to;
+
+    from.f = NAN;
+    CHECK(lop_coerce(LOP_INT32, &to, LOP_FLOAT, &from) && to.i == 0);
+    from.f = 1e20f;
+    CHECK(lop_coerce(LOP_INT32, &to, LOP_FLOAT, &from) &&
+          to.i == INT32_MAX);
+    from.d = -1e20;
+    CHECK(lop_coerce(LOP_INT32, &to, LOP_DOUBLE, &from) &&
+          to.i == INT32_MIN);
+    from.d = -3.7;
+    CHECK(lop_coerce(LOP_INT32, &to, LOP_DOUBLE, &from) && to.i == -3);
+    from.f = 1e30f;
+    CHECK(lop_coerce(LOP_INT64, &to, LOP_FLOAT, &from) &&
+          to.h == INT64_MAX);
+    from.d = -HUGE_VAL;
+    CHECK(lop_coerce(LOP_INT64, &to, LOP_DOUBLE, &from) &&
+          to.h == INT64_MIN);
+    from.d = NAN;
+    CHECK(lop_coerce(LOP_INT64, &to, LOP_DOUBLE, &from) && to.h == 0);
+
+    /* and the same when dispatch coerces a message */
+    server = lop_server_new(NULL, NULL, NULL);
+    lop_server_add_method(server, "/i", "i", int_handler, NULL);
+    dispatch_float(server, "/i", 3e9f);
+    CHECK(int_arg == INT32_MAX);
+    dispatch_float(server, "/i", NAN);
+    CHECK(int_arg == 0);
+    dispatch_float(server, "/i", -2.5f);
+    CHECK(int_arg == -2);
+    lop_server_free(server);
+}
+
+/* and when copied out of a message, in blocks and one at a time */
+static void test_get_int32s_clamp(void)
+{
+    lop_message m = lop_message_new();
+    int32_t out[20];
+    int i;
+
+    for (i = 0; i < 10; i++) {
+        lop_message_add_float(m, i & 1 ? -1e10f : NAN);
+    }
+    for (i = 0; i < 10; i++) {
+        lop_message_add_double(m, i & 1 ? 1e300 : -7.9);
+    }
+    CHECK(lop_message_get_int32s(m, 0, -1, out) == 20);
+    for (i = 0; i < 10; i++) {
+        CHECK(out[i] == (i & 1 ? INT32_MIN : 0));
+        CHECK(out[10 + i] == (i & 1 ? INT32_MAX : -7));
+    }
+    lop_message_free(m);
+}
+
+static int cue_calls;
+
+static int cue_handler(const char *path, const char *types,
+    lop_arg **argv, int argc, lop_message msg, void *user_data)
+{
+    cue_calls++;
+    return 0;
+}
+
+/* Schedule a one-message bundle for t */
+static void schedule_cue(lop_server s, lop_timetag t)
+{
+    lop_message m = lop_message_new();
+    size_t msg_size, size;
+    char *packet;
+
+    lop_message_add_int32(m, 0);
+    msg_size = lop_message_length(m, "/cue");
+    size = 20 + msg_size;
+    packet = malloc(size);
+    memcpy(packet, "#bundle\0", 8);
+    *(uint32_t *)(packet + 8) = lop_htoo32(t.sec);
+    *(uint32_t *)(packet + 12) = lop_htoo32(t.frac);
+    *(uint32_t *)(packet + 16) = lop_htoo32(msg_size);
+    lop_message_serialise(m, "/cue", packet + 20, NULL);
+    lop_server_dispatch_data(s, packet, size);
+    free(packet);
+    lop_message_free(m);
+}
+
+/* The wall clock in steps of about 100us, so that it lags the monotonic
+ * clock the wait sleeps on by more than the scheduling slack */
+static void coarse_clock(lop_timetag *t, void *arg)
+{
+    lop_timetag_now(t);
+    t->frac -= t->frac % 429497;
+}
+
+/* One wait dispatches the next event, however far the server's clock is
+ * behind the one the wait sleeps on */
+static void test_wait_until_next(void)
+{
+    lop_timetag t;
+    int i, early = 0;
+
+    server = lop_server_new(NULL, NULL, NULL);
+    lop_server_add_method(server, "/cue", "i", cue_handler, NULL);
+    lop_server_set_clock(server, coarse_clock, NULL);
+    cue_calls = 0;
+    for (i = 0; i < 100; i++) {
+        /* due between two steps of the clock */
+        coarse_clock(&t, NULL);
+        t = lop_timetag_add_ns(t, 550000);
+        schedule_cue(server, t);
+        if (lop_server_wait_until_next(server, -1) != 1) {
+            early++;
+        }
+    }
+    CHECK(early == 0);
+    CHECK(cue_calls == 100);
+
+    /* a timeout before the event returns 0 without dispatching it */
+    coarse_clock(&t, NULL);
+    schedule_cue(server, lop_timetag_add_ns(t, 200000000));
+    CHECK(lop_server_wait_until_next(server, 1) == 0);
+    CHECK(cue_calls == 100);
+    CHECK(lop_server_events_pending(server));
+    lop_server_free(server);
+}
+
+#define CLOCK_THREADS 4
+
+static void *read_clock(void *arg)
+{
+    lop_clock_monotonic(arg, NULL);
+    return NULL;
+}
+
+/* Threads reading the monotonic clock first at the same time agree on
+ * its anchor, and so on the time */
+static void test_clock_monotonic_threads(void)
+{
+    pthread_t threads[CLOCK_THREADS];
+    lop_timetag t[CLOCK_THREADS], before, after;
+    int i;
+
+    lop_timetag_now(&before);
+    for (i = 0; i < CLOCK_THREADS; i++) {
+        pthread_create(&threads[i], NULL, read_clock, &t[i]);
+    }
+    for (i = 0; i < CLOCK_THREADS; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    lop_timetag_now(&after);
+    for (i = 0; i < CLOCK_THREADS; i++) {
+        CHECK(lop_timetag_diff_ns(t[i], before) > -1000000);
+        CHECK(lop_timetag_diff_ns(after, t[i]) > -1000000);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    /* first, so that the threads are the clock's first readers */
+    test_clock_monotonic_threads();
+    test_del_sibling();
+    test_nested_dispatch();
+    test_del_pattern();
+    test_coerce_clamp();
+    test_get_int32s_clamp();
+    test_wait_until_next();
+
+    if (failures) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("all tests passed\n");
+    return 0;
+}
@@ -15,7 +15,9 @@
  */
 
 #include "lop_types_internal.h"
+#include "lop/lop_timetag.h"
 
+#include <pthread.h>
 #include <sys/time.h>
 #include <time.h>
 
@@ -33,5 +35,34 @@ void lop_timetag_now(lop_timetag *t)
 
 	gettimeofday(&tv, NULL);
 	t->sec = tv.tv_sec + JAN_1970;
-	t->frac = tv.tv_usec * 4294.967295;
+	t->frac = ((uint64_t)tv.tv_usec << 32) / 1000000;
+}
+
+/* wall clock time of the monotonic clock's zero, 32.32 fixed; set once,
+ * as pthread_once() both serialises the first readers and publishes it
+ * whole to later ones, where a 32 bit target would tear a plain store */
+static uint64_t mono_anchor;
+static pthread_once_t mono_anchor_once = PTHREAD_ONCE_INIT;
+
+static int64_t mono_units(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return lop_timetag_ns_to_units((int64_t)ts.tv_sec * 1000000000 +
+				       ts.tv_nsec);
+}
+
+static void mono_anchor_init(void)
+{
+	lop_timetag wall;
+
+	lop_timetag_now(&wall);
+	mono_anchor = lop_timetag_to_fixed(wall) - (uint64_t)mono_units();
+}
+
+void lop_clock_monotonic(lop_timetag *t, void *arg)
+{
+	pthread_once(&mono_anchor_once, mono_anchor_init);
+	*t = lop_timetag_from_fixed(mono_anchor + (uint64_t)mono_units());
 }